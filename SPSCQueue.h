@@ -7,6 +7,9 @@
 #include <algorithm>
 #include <stdexcept>
 
+namespace so
+{
+
 template <class T>
 struct QueueNode {
 	template <typename... Param>
@@ -195,3 +198,5 @@ inline void SPSCQueue<T>::emplace(Param&& ...args)
 {
 	this->inner_enq(*new QueueNode<T>{ std::forward<Param>(args)... });
 }
+
+} // namespace so
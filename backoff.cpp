@@ -0,0 +1,31 @@
+#include "backoff.h"
+#include "flight_recorder.h"
+
+using namespace std;
+
+namespace so
+{
+
+void Backoff::failed(unsigned home)
+{
+    auto &state = t_contention;
+    state.record(true);
+    ++t_op_counters.retries;
+    uint64_t bound = min<uint64_t>((uint64_t)state.limit << min(retries, 16u), BACKOFF_MAX);
+    ++retries;
+    if (home != current_node())
+        bound *= BACKOFF_REMOTE_FACTOR;
+
+    // xorshift. thread마다 다른 값에서 시작하도록 state의 주소를 섞는다.
+    if (state.rng == 0)
+        state.rng = reinterpret_cast<uintptr_t>(&state) | 1;
+    state.rng ^= state.rng << 13;
+    state.rng ^= state.rng >> 7;
+    state.rng ^= state.rng << 17;
+    for (uint64_t spins = 1 + state.rng % bound; spins != 0; --spins)
+    {
+        cpu_relax();
+    }
+}
+
+} // namespace so
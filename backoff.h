@@ -0,0 +1,69 @@
+#ifndef B8D2E6F1_0C47_4A93_9E5B_7F1A3C6D2E84
+#define B8D2E6F1_0C47_4A93_9E5B_7F1A3C6D2E84
+
+#include <algorithm>
+#include <cstdint>
+#include "topology.h"
+
+namespace so
+{
+
+// CAS가 실패한 뒤 기다리는 시간의 단위는 cpu_relax() 한번이다.
+constexpr unsigned BACKOFF_MIN = 4;
+constexpr unsigned BACKOFF_MAX = 4096;
+// 다른 node에서 만든 노드에 대한 CAS가 실패했으면 이만큼 더 기다려서 그 node의 thread가 먼저 끝내게 한다.
+constexpr unsigned BACKOFF_REMOTE_FACTOR = 4;
+// thread마다 CAS를 이만큼 할 때마다 실패율을 보고 backoff 시작 상한을 조절한다.
+constexpr unsigned BACKOFF_WINDOW = 256;
+
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#else
+    asm volatile("" ::: "memory");
+#endif
+}
+
+// thread의 최근 CAS 실패율. 실패가 잦으면 처음부터 길게 기다리고, 드물면 짧게 기다린다.
+struct ContentionState
+{
+    unsigned limit = BACKOFF_MIN;
+    unsigned attempts = 0;
+    unsigned failures = 0;
+    uint64_t rng = 0;
+
+    void record(bool failed)
+    {
+        ++attempts;
+        failures += failed ? 1 : 0;
+        if (attempts < BACKOFF_WINDOW)
+            return;
+        if (failures * 4 > attempts)
+            limit = std::min(limit * 2, BACKOFF_MAX);
+        else if (failures * 32 < attempts)
+            limit = std::max(limit / 2, BACKOFF_MIN);
+        attempts = 0;
+        failures = 0;
+    }
+};
+
+inline thread_local ContentionState t_contention;
+
+// operation 하나 동안 쓰는 contention manager. 같은 operation 안에서 실패가 반복될수록 지수적으로 더 기다린다.
+class Backoff
+{
+public:
+    // home node에서 만든 노드에 대한 CAS가 실패했다.
+    void failed(unsigned home);
+    void succeeded() { t_contention.record(false); }
+
+private:
+    unsigned retries = 0;
+};
+
+} // namespace so
+
+#endif /* B8D2E6F1_0C47_4A93_9E5B_7F1A3C6D2E84 */
@@ -0,0 +1,43 @@
+#include <new>
+#include "bytes_node.h"
+#include "node_arena.h"
+
+using namespace std;
+
+namespace so
+{
+
+LFNODE *new_bytes_node(const BytesKey &key, string_view value)
+{
+    const bool inline_value = value.size() <= INLINE_VALUE_MAX;
+    const size_t size = sizeof(LFNODE) + sizeof(BytesHeader) + key.bytes.size() +
+                        (inline_value ? value.size() : sizeof(char *));
+    auto raw = reinterpret_cast<char *>(arena_alloc(size));
+
+    auto node = new (raw) LFNODE{key.so_key, key.hash};
+    node->home = current_node();
+    node->kind = NODE_BYTES;
+    auto header = new (raw + sizeof(LFNODE)) BytesHeader{(uint32_t)key.bytes.size(), (uint32_t)value.size()};
+    auto key_bytes = reinterpret_cast<char *>(header + 1);
+    memcpy(key_bytes, key.bytes.data(), key.bytes.size());
+    if (inline_value)
+    {
+        memcpy(key_bytes + key.bytes.size(), value.data(), value.size());
+    }
+    else
+    {
+        auto out_of_line = reinterpret_cast<char *>(arena_alloc(value.size()));
+        memcpy(out_of_line, value.data(), value.size());
+        memcpy(key_bytes + key.bytes.size(), &out_of_line, sizeof(out_of_line));
+    }
+    return node;
+}
+
+void free_bytes_node(LFNODE *node)
+{
+    if (bytes_header(*node)->value_len > INLINE_VALUE_MAX)
+        arena_free(const_cast<char *>(bytes_value(*node).data()));
+    arena_free(node);
+}
+
+} // namespace so
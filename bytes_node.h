@@ -0,0 +1,83 @@
+#ifndef E4A2C9B7_1F63_4D8E_A05B_7C3D9E21F6A4
+#define E4A2C9B7_1F63_4D8E_A05B_7C3D9E21F6A4
+
+#include <cstring>
+#include <string_view>
+#include "lf_set.h"
+
+namespace so
+{
+
+// byte string key/value를 담는 노드. LFNODE 바로 뒤에 BytesHeader, key byte, value가 이어지고
+// node arena에서 한 block으로 할당된다. LFNODE::key는 split-ordered key, LFNODE::value는 key 전체의 hash.
+// value가 INLINE_VALUE_MAX 이하면 key 뒤에 그대로 두고, 더 길면 따로 할당한 block의 pointer만 둔다.
+constexpr uint32_t INLINE_VALUE_MAX = 128;
+
+struct BytesHeader
+{
+    uint32_t key_len;
+    uint32_t value_len;
+};
+
+struct BytesKey
+{
+    unsigned long so_key;
+    unsigned long hash;
+    std::string_view bytes;
+};
+
+inline const BytesHeader *bytes_header(const LFNODE &node)
+{
+    return reinterpret_cast<const BytesHeader *>(&node + 1);
+}
+
+inline std::string_view bytes_key(const LFNODE &node)
+{
+    auto header = bytes_header(node);
+    return {reinterpret_cast<const char *>(header + 1), header->key_len};
+}
+
+inline std::string_view bytes_value(const LFNODE &node)
+{
+    auto header = bytes_header(node);
+    auto after_key = reinterpret_cast<const char *>(header + 1) + header->key_len;
+    if (header->value_len <= INLINE_VALUE_MAX)
+        return {after_key, header->value_len};
+    const char *out_of_line;
+    memcpy(&out_of_line, after_key, sizeof(out_of_line));
+    return {out_of_line, header->value_len};
+}
+
+// list 안에서 node가 key보다 앞이면 음수, 같으면 0, 뒤면 양수.
+// split-ordered key와 hash가 모두 같을 때만 key byte를 비교한다.
+inline int compare_bytes(const LFNODE &node, const BytesKey &key)
+{
+    if (node.key != key.so_key)
+        return node.key < key.so_key ? -1 : 1;
+    if (node.kind != NODE_BYTES)
+        return -1;
+    if (node.value != key.hash)
+        return node.value < key.hash ? -1 : 1;
+    auto node_key = bytes_key(node);
+    if (node_key.size() != key.bytes.size())
+        return node_key.size() < key.bytes.size() ? -1 : 1;
+    return memcmp(node_key.data(), key.bytes.data(), node_key.size());
+}
+
+// 노드 하나가 차지하는 메모리 (memory budget 계산용)
+inline size_t node_footprint(const LFNODE &node)
+{
+    if (node.kind != NODE_BYTES)
+        return sizeof(LFNODE);
+    auto header = bytes_header(node);
+    return sizeof(LFNODE) + sizeof(BytesHeader) + header->key_len + header->value_len +
+           (header->value_len > INLINE_VALUE_MAX ? sizeof(char *) : 0);
+}
+
+// 현재 thread의 NUMA node arena에 노드를 만든다.
+LFNODE *new_bytes_node(const BytesKey &key, std::string_view value);
+void free_bytes_node(LFNODE *node);
+
+} // namespace so
+
+#endif /* E4A2C9B7_1F63_4D8E_A05B_7C3D9E21F6A4 */
@@ -0,0 +1,65 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "so_c_api.h"
+
+// C compiler로 빌드해서 shared library의 C API만으로 table을 쓸 수 있는지 확인한다.
+// NUMA node가 둘 이상이어야 하므로 SO_VIRTUAL_NODES=2로 실행한다. (ctest가 설정)
+#define CHECK(cond)                                                                  \
+    do                                                                               \
+    {                                                                                \
+        if (!(cond))                                                                 \
+        {                                                                            \
+            fprintf(stderr, "%s:%d: %s failed (%s)\n", __FILE__, __LINE__, #cond, so_last_error()); \
+            return 1;                                                                \
+        }                                                                            \
+    } while (0)
+
+// node마다 다른 sweeper thread에서 동시에 불리므로 ctx의 counter는 atomic으로 센다.
+static int is_even(unsigned long key, unsigned long value, void *ctx)
+{
+    (void)value;
+    atomic_fetch_add((atomic_int *)ctx, 1);
+    return key % 2 == 0;
+}
+
+int main(void)
+{
+    unsigned long value = 0;
+    char buf[16];
+    size_t value_len = 0;
+    atomic_int visited = 0;
+    so_table *table;
+
+    CHECK(so_bind_thread(0) == 0);
+    CHECK(so_table_open_shared("", 1) == NULL);
+    CHECK(strlen(so_last_error()) != 0);
+
+    table = so_table_create(2);
+    CHECK(table != NULL);
+    for (unsigned long key = 0; key < 100; ++key)
+        CHECK(so_insert(table, key, key * 10) == 1);
+    CHECK(so_insert(table, 7, 0) == 0);
+    CHECK(so_find(table, 7, &value) == 1 && value == 70);
+    CHECK(so_remove(table, 7) == 1);
+    CHECK(so_remove(table, 7) == 0);
+    CHECK(so_find(table, 7, &value) == 0);
+
+    CHECK(so_insert_bytes(table, "alpha", 5, "first value", 11) == 1);
+    CHECK(so_find_bytes(table, "alpha", 5, buf, 5, &value_len) == 1);
+    CHECK(value_len == 11 && memcmp(buf, "first", 5) == 0);
+    CHECK(so_remove_bytes(table, "alpha", 5) == 1);
+    CHECK(so_find_bytes(table, "alpha", 5, buf, sizeof(buf), &value_len) == 0);
+
+    CHECK(so_erase_if(table, is_even, &visited) == 50);
+    CHECK(atomic_load(&visited) == 99);
+    CHECK(so_find(table, 8, &value) == 0);
+    CHECK(so_find(table, 9, &value) == 1);
+
+    CHECK(so_insert_ttl(table, 1000, 1, 60000) == 1);
+    CHECK(so_find(table, 1000, &value) == 1 && value == 1);
+
+    so_table_destroy(table);
+    printf("c api: OK\n");
+    return 0;
+}
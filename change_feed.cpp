@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <numa.h>
+#include "change_feed.h"
+#include "topology.h"
+
+using namespace std;
+
+namespace so
+{
+
+ChangeRing::ChangeRing(unsigned numa_id, size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity)
+        size *= 2;
+    mask = size - 1;
+    slots = static_cast<Slot *>(numa_alloc_onnode(sizeof(Slot) * size, real_node(numa_id)));
+    if (slots == nullptr)
+        throw bad_alloc();
+    for (size_t i = 0; i < size; ++i)
+        new (&slots[i]) Slot{{i}, {}};
+}
+
+ChangeRing::~ChangeRing()
+{
+    numa_free(slots, sizeof(Slot) * capacity());
+}
+
+// slot의 seq가 pos이면 비어 있고, pos + 1이면 채워져 있다. consumer가 꺼내면 한바퀴 뒤의 pos로 바꾼다.
+bool ChangeRing::try_push(const ChangeEvent &event)
+{
+    auto pos = tail.load(memory_order_relaxed);
+    Slot *slot;
+    while (true)
+    {
+        slot = &slots[pos & mask];
+        const auto seq = slot->seq.load(memory_order_acquire);
+        const auto diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = tail.load(memory_order_relaxed);
+        }
+    }
+    slot->event = event;
+    slot->seq.store(pos + 1, memory_order_release);
+    return true;
+}
+
+void ChangeRing::push_overflow(const ChangeEvent &event)
+{
+    if (try_push(event))
+        return;
+    lock_guard<mutex> guard{overflow_lock};
+    overflow.push_back(event);
+    has_overflow.store(true, memory_order_release);
+}
+
+size_t ChangeRing::pop(vector<ChangeEvent> &out, size_t max_batch)
+{
+    size_t popped = 0;
+    while (popped < max_batch)
+    {
+        auto &slot = slots[head & mask];
+        if (slot.seq.load(memory_order_acquire) != head + 1)
+            break;
+        out.push_back(slot.event);
+        slot.seq.store(head + mask + 1, memory_order_release);
+        ++head;
+        ++popped;
+    }
+    if (popped < max_batch && has_overflow.load(memory_order_acquire))
+    {
+        lock_guard<mutex> guard{overflow_lock};
+        auto n = min(max_batch - popped, overflow.size());
+        out.insert(out.end(), overflow.begin(), overflow.begin() + n);
+        overflow.erase(overflow.begin(), overflow.begin() + n);
+        has_overflow.store(false == overflow.empty(), memory_order_relaxed);
+        popped += n;
+    }
+    return popped;
+}
+
+static thread_local bool t_internal_thread = false;
+
+void mark_internal_thread()
+{
+    t_internal_thread = true;
+}
+
+bool is_internal_thread()
+{
+    return t_internal_thread;
+}
+
+KeyLocks::KeyLocks() : stripes{new Stripe[1u << CHANGE_STRIPE_BITS]}
+{
+}
+
+void KeyLocks::lock(size_t stripe)
+{
+    auto &locked = stripes[stripe].locked;
+    while (locked.exchange(true, memory_order_acquire))
+    {
+        while (locked.load(memory_order_relaxed))
+            this_thread::yield();
+    }
+}
+
+// 여러 key의 stripe는 교착이 없도록 정렬해서 중복 없이 잡는다.
+ChangeOrder::ChangeOrder(KeyLocks *locks, const unsigned long *keys, size_t key_num) : locks{locks}
+{
+    if (locks == nullptr)
+        return;
+    if (key_num > MCAS_MAX_WORDS)
+        throw invalid_argument("too many keys for a multi-key update");
+    for (size_t i = 0; i < key_num; ++i)
+        stripes[i] = locks->stripe(keys[i]);
+    sort(stripes, stripes + key_num);
+    stripe_num = unique(stripes, stripes + key_num) - stripes;
+    for (size_t i = 0; i < stripe_num; ++i)
+        locks->lock(stripes[i]);
+}
+
+ChangeOrder::~ChangeOrder()
+{
+    for (size_t i = 0; i < stripe_num; ++i)
+        locks->unlock(stripes[i]);
+}
+
+uint64_t ChangeOrder::stamp(atomic_uint64_t &seq, unsigned n)
+{
+    if (locks == nullptr)
+        return 0;
+    return seq.fetch_add(n, memory_order_relaxed) + 1;
+}
+
+} // namespace so
@@ -0,0 +1,112 @@
+#ifndef A6E3B9D1_4F72_4C08_B1A5_9D2C7E5F3B40
+#define A6E3B9D1_4F72_4C08_B1A5_9D2C7E5F3B40
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "mcas.h"
+
+namespace so
+{
+
+enum class ChangeType : uint8_t
+{
+    INSERT,
+    REMOVE,
+    UPDATE, // multi_update의 UPDATE. value가 바뀐 새 값
+};
+
+struct ChangeEvent
+{
+    uint64_t seq; // table 전체에서 증가하는 번호. 1부터 시작. 같은 key의 event끼리는 실제로 일어난 순서와 같다.
+    unsigned long key;
+    unsigned long value; // INSERT/UPDATE의 값. REMOVE는 0
+    uint32_t ttl_ms;     // TTL을 주고 넣었으면 기록할 때 남은 시간, 아니면 0
+    ChangeType type;
+};
+
+// node마다 하나씩 두는 bounded ring. 그 node의 thread들이 producer이고 consumer는 하나다.
+// slot마다 sequence를 두어 producer끼리는 tail CAS 한번으로 자리를 나눠 갖는다.
+class ChangeRing
+{
+public:
+    // capacity는 2의 거듭제곱으로 올림한다. slot들은 numa_id번째 (가상) node의 메모리에 둔다.
+    ChangeRing(unsigned numa_id, size_t capacity);
+    ~ChangeRing();
+    ChangeRing(const ChangeRing &) = delete;
+
+    // 가득 찼으면 false
+    bool try_push(const ChangeEvent &event);
+    // 가득 차도 기다리지 않고 overflow list에 넣는다. helper/sweeper처럼 consumer를 기다리게 할 수 있는 thread용
+    void push_overflow(const ChangeEvent &event);
+    // 최대 max_batch개를 out 뒤에 붙이고 꺼낸 수를 반환. ring이 비면 overflow list에서 꺼낸다. consumer 하나만 호출해야 한다.
+    size_t pop(std::vector<ChangeEvent> &out, size_t max_batch);
+    size_t capacity() const { return mask + 1; }
+    // 가득 차서 버린 event 수 (back-pressure를 끈 경우)
+    std::atomic_uint64_t dropped{0};
+
+private:
+    struct Slot
+    {
+        std::atomic_size_t seq;
+        ChangeEvent event;
+    };
+
+    size_t mask;
+    Slot *slots;
+    alignas(64) std::atomic_size_t tail{0};
+    alignas(64) size_t head = 0; // consumer만 사용
+    std::atomic_bool has_overflow{false};
+    std::mutex overflow_lock;
+    std::deque<ChangeEvent> overflow;
+};
+
+// local helper, erase_if sweeper, delegation owner처럼 table 안에서 도는 thread가 시작할 때 호출한다.
+// 이 thread들은 ring이 가득 차도 consumer를 기다리지 않고 overflow list에 넣는다.
+// (consumer가 erase_if 등으로 이 thread들을 기다리고 있으면 서로 기다리게 되기 때문)
+void mark_internal_thread();
+bool is_internal_thread();
+
+// 같은 key의 mutation과 seq 발급을 묶는 striped spin lock. mutation이 linearize 되는 동안 key의 stripe를 잡고
+// 그 안에서 seq를 받으므로, 같은 key의 event는 seq 순서가 실제 순서와 같다. key는 split-ordered key를 쓴다.
+constexpr unsigned CHANGE_STRIPE_BITS = 10;
+
+class KeyLocks
+{
+public:
+    KeyLocks();
+    size_t stripe(unsigned long key) const { return (key * 0x9E3779B97F4A7C15ul) >> (64 - CHANGE_STRIPE_BITS); }
+    void lock(size_t stripe);
+    void unlock(size_t stripe) { stripes[stripe].locked.store(false, std::memory_order_release); }
+
+private:
+    struct alignas(64) Stripe
+    {
+        std::atomic_bool locked{false};
+    };
+    std::unique_ptr<Stripe[]> stripes;
+};
+
+// 생성자에서 key들의 stripe를 잡고 소멸자에서 놓는다. mutation이 성공하면 그 사이에 stamp()로 seq를 받는다.
+// locks가 nullptr이면 (change feed가 꺼져 있으면) 아무것도 하지 않는다.
+class ChangeOrder
+{
+public:
+    ChangeOrder(KeyLocks *locks, const unsigned long *keys, size_t key_num);
+    ~ChangeOrder();
+    ChangeOrder(const ChangeOrder &) = delete;
+    // n개의 연속된 seq를 받아 첫 seq를 반환. 꺼져 있으면 0
+    uint64_t stamp(std::atomic_uint64_t &seq, unsigned n = 1);
+
+private:
+    KeyLocks *locks;
+    size_t stripe_num = 0;
+    size_t stripes[MCAS_MAX_WORDS];
+};
+
+} // namespace so
+
+#endif /* A6E3B9D1_4F72_4C08_B1A5_9D2C7E5F3B40 */
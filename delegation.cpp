@@ -0,0 +1,121 @@
+#include "change_feed.h"
+#include "delegation.h"
+#include "perf_counters.h"
+#include "split_ordered.h"
+#include "topology.h"
+
+using namespace std;
+
+namespace so
+{
+
+enum SlotState
+{
+    SLOT_EMPTY,
+    SLOT_REQUEST,
+    SLOT_RESPONSE,
+};
+
+// 연속된 key가 같은 owner에 몰리지 않도록 섞는다.
+static unsigned long mix_key(unsigned long key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdUL;
+    key ^= key >> 33;
+    return key;
+}
+
+Delegation::Delegation(SO_Hashtable *table, unsigned node_num, unsigned owners_per_node) : table{table}
+{
+    const unsigned owner_num = node_num * owners_per_node;
+    owner_tid = vector<atomic_int>(owner_num);
+    for (unsigned i = 0; i < owner_num; ++i)
+    {
+        rows.push_back(NUMA_alloc<DelegationRow>(i % node_num));
+    }
+    // owner i는 node i % node_num에 있다.
+    for (unsigned i = 0; i < owner_num; ++i)
+    {
+        owners.emplace_back(&Delegation::owner_func, this, i, i % node_num);
+    }
+}
+
+Delegation::~Delegation()
+{
+    stop.store(true, memory_order_relaxed);
+    for (auto &owner : owners)
+    {
+        owner.join();
+    }
+    for (auto row : rows)
+    {
+        NUMA_dealloc(row);
+    }
+}
+
+void Delegation::owner_func(unsigned owner, unsigned node)
+{
+    owner_tid[owner].store(current_tid(), memory_order_release);
+    mark_internal_thread();
+    set_current_node(node);
+    run_on_node(node);
+    auto &row = *rows[owner];
+    while (false == stop.load(memory_order_relaxed))
+    {
+        bool worked = false;
+        const auto limit = slot_limit.load(memory_order_acquire);
+        // 한 번 훑을 때 쌓여 있는 request를 모두 처리한다.
+        for (unsigned i = 0; i < limit; ++i)
+        {
+            auto &slot = row.slots[i];
+            if (slot.state.load(memory_order_acquire) != SLOT_REQUEST)
+                continue;
+            if (slot.op == DelegatedOp::INSERT)
+                slot.result = table->insert_local(slot.key, slot.value);
+            else
+                slot.result = table->remove_local(slot.key);
+            slot.state.store(SLOT_RESPONSE, memory_order_release);
+            worked = true;
+        }
+        if (!worked)
+            this_thread::yield();
+    }
+}
+
+bool Delegation::execute(DelegatedOp op, unsigned long key, unsigned long value)
+{
+    const unsigned client = thread_slot();
+    auto limit = slot_limit.load(memory_order_relaxed);
+    while (limit <= client && !slot_limit.compare_exchange_weak(limit, client + 1))
+    {
+    }
+
+    auto &slot = rows[mix_key(key) % rows.size()]->slots[client];
+    slot.op = op;
+    slot.key = key;
+    slot.value = value;
+    slot.state.store(SLOT_REQUEST, memory_order_release);
+    for (unsigned spin = 0; slot.state.load(memory_order_acquire) != SLOT_RESPONSE; ++spin)
+    {
+        if (spin % 64 == 63)
+            this_thread::yield();
+    }
+    slot.state.store(SLOT_EMPTY, memory_order_relaxed);
+    return slot.result;
+}
+
+vector<pid_t> Delegation::owner_tids() const
+{
+    vector<pid_t> tids;
+    for (auto &tid : owner_tid)
+    {
+        while (tid.load(memory_order_acquire) == 0)
+        {
+            this_thread::yield();
+        }
+        tids.push_back(tid.load(memory_order_relaxed));
+    }
+    return tids;
+}
+
+} // namespace so
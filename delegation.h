@@ -0,0 +1,59 @@
+#ifndef D61E8B3A_9F24_4C7D_A1E5_3B8C0F6D2A97
+#define D61E8B3A_9F24_4C7D_A1E5_3B8C0F6D2A97
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "lf_set.h"
+
+namespace so
+{
+
+class SO_Hashtable;
+
+enum class DelegatedOp : uint8_t
+{
+    INSERT,
+    REMOVE,
+};
+
+// client thread 하나와 owner thread 하나 사이의 request/response slot. cache line 하나를 둘만 쓴다.
+struct alignas(64) DelegationSlot
+{
+    std::atomic_int state{0};
+    DelegatedOp op;
+    bool result;
+    unsigned long key;
+    unsigned long value;
+};
+
+// owner 하나가 받는 slot들. owner의 node에 할당된다. client는 자기 epoch slot 번호의 slot을 쓴다.
+struct DelegationRow
+{
+    DelegationSlot slots[MAX_THREAD];
+};
+
+// key를 owner thread들에게 나눠주고, insert/remove는 key의 owner만 실행하도록 한다.
+// 뜨거운 key의 list node를 한 core만 쓰게 되어 node 사이의 CAS 경쟁이 사라진다.
+class Delegation
+{
+public:
+    Delegation(SO_Hashtable *table, unsigned node_num, unsigned owners_per_node);
+    ~Delegation();
+    bool execute(DelegatedOp op, unsigned long key, unsigned long value);
+    std::vector<pid_t> owner_tids() const;
+
+private:
+    SO_Hashtable *table;
+    std::vector<DelegationRow *> rows;
+    std::vector<std::thread> owners;
+    std::vector<std::atomic_int> owner_tid;
+    std::atomic_uint slot_limit{0}; // 지금까지 쓰인 client slot 번호 + 1. owner는 여기까지만 본다
+    std::atomic_bool stop{false};
+
+    void owner_func(unsigned owner, unsigned node);
+};
+
+} // namespace so
+
+#endif /* D61E8B3A_9F24_4C7D_A1E5_3B8C0F6D2A97 */
@@ -0,0 +1,74 @@
+#include <new>
+#include <stdexcept>
+#include <numa.h>
+#include "dummy_arena.h"
+#include "node_arena.h"
+#include "topology.h"
+
+using namespace std;
+
+namespace so
+{
+
+DummyArena::DummyArena()
+    : chunks{new atomic<LFNODE *>[DUMMY_CHUNK_NUM]{}}, cursors(ARENA_MAX_NODE, 0), free_refs(ARENA_MAX_NODE)
+{
+}
+
+DummyArena::~DummyArena()
+{
+    for (uint32_t i = 0; i < chunk_num; ++i)
+    {
+        numa_free(chunks[i].load(memory_order_relaxed), sizeof(LFNODE) * DUMMY_CHUNK_SIZE);
+    }
+}
+
+// dummy node는 init_bucket에서만 만들므로 lock으로 충분하다.
+LFNODE *DummyArena::alloc(unsigned long key)
+{
+    uint32_t ref;
+    {
+        lock_guard<mutex> guard{this->lock};
+        auto &cursor = this->cursors[current_node() % ARENA_MAX_NODE];
+        auto &free_refs = this->free_refs[current_node() % ARENA_MAX_NODE];
+        if (false == free_refs.empty())
+        {
+            ref = free_refs.back();
+            free_refs.pop_back();
+        }
+        else
+        {
+            if (cursor == 0)
+            {
+                if (this->chunk_num == DUMMY_CHUNK_NUM)
+                    throw runtime_error("too many dummy nodes for 32-bit references");
+                auto chunk = static_cast<LFNODE *>(numa_alloc_onnode(sizeof(LFNODE) * DUMMY_CHUNK_SIZE, real_node(current_node())));
+                if (chunk == nullptr)
+                    throw bad_alloc();
+                this->chunks[this->chunk_num].store(chunk, memory_order_release);
+                cursor = this->chunk_num << DUMMY_CHUNK_BITS;
+                // ref 0은 nullptr이므로 첫 chunk의 첫 칸은 쓰지 않는다.
+                if (cursor == 0)
+                    cursor = 1;
+                ++this->chunk_num;
+            }
+            ref = cursor++;
+            if ((cursor & (DUMMY_CHUNK_SIZE - 1)) == 0)
+                cursor = 0;
+        }
+    }
+    auto node = new (this->node(ref)) LFNODE{key, ref};
+    node->home = current_node();
+    return node;
+}
+
+void DummyArena::free(LFNODE *node)
+{
+    const auto ref = (uint32_t)node->value;
+    const auto home = node->home % ARENA_MAX_NODE;
+    node->~LFNODE();
+    lock_guard<mutex> guard{this->lock};
+    this->free_refs[home].push_back(ref);
+}
+
+} // namespace so
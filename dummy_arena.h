@@ -0,0 +1,50 @@
+#ifndef C9B2E5A7_1D84_4F3C_8E69_5A0D7B3C2F16
+#define C9B2E5A7_1D84_4F3C_8E69_5A0D7B3C2F16
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "lf_set.h"
+
+namespace so
+{
+
+// SO_COMPACT_REFS에서 dummy node를 담는 arena. dummy node는 table이 없어질 때까지 지워지지 않으므로
+// 32bit 번호(ref)로 가리킬 수 있고, bucket array replica는 pointer 대신 ref를 저장한다.
+// ref의 위 16bit는 chunk 번호, 아래 16bit는 chunk 안의 위치이다. 0은 nullptr을 뜻한다.
+// LFNODE::next는 64bit pointer로 둔다. key/value 뒤에 8byte 경계로 놓여서 32bit로 줄여도 LFNODE는 32byte 그대로이고,
+// mark bit와 MCAS descriptor tag도 담아야 하며, regular node는 arena가 아니라 하나씩 회수되기 때문이다.
+constexpr unsigned DUMMY_CHUNK_BITS = 16;
+constexpr uint32_t DUMMY_CHUNK_SIZE = 1u << DUMMY_CHUNK_BITS;
+constexpr uint32_t DUMMY_CHUNK_NUM = 1u << (32 - DUMMY_CHUNK_BITS);
+
+class DummyArena
+{
+public:
+    DummyArena();
+    ~DummyArena();
+    DummyArena(const DummyArena &) = delete;
+
+    // 현재 thread의 node에 있는 chunk에서 dummy node를 만든다. value에는 자기 ref가 들어간다.
+    LFNODE *alloc(unsigned long key);
+    // list에 넣지 못한 dummy node를 돌려준다.
+    void free(LFNODE *node);
+    LFNODE *node(uint32_t ref) const
+    {
+        return chunks[ref >> DUMMY_CHUNK_BITS].load(std::memory_order_acquire) + (ref & (DUMMY_CHUNK_SIZE - 1));
+    }
+
+private:
+    std::unique_ptr<std::atomic<LFNODE *>[]> chunks;
+    std::mutex lock;
+    uint32_t chunk_num = 0;
+    std::vector<uint32_t> cursors; // node마다 다음에 줄 ref. 0이면 새 chunk가 필요
+    // node마다 돌려받은 ref. 다른 node의 chunk에 있는 ref를 주면 home이 실제 메모리 위치와 달라진다.
+    std::vector<std::vector<uint32_t>> free_refs;
+};
+
+} // namespace so
+
+#endif /* C9B2E5A7_1D84_4F3C_8E69_5A0D7B3C2F16 */
@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include "flight_recorder.h"
+#include "lf_set.h"
+#include "perf_counters.h"
+#include "topology.h"
+
+using namespace std;
+
+namespace so
+{
+
+// 주인 thread만 쓰고 dump 하는 thread가 동시에 읽는다. slot의 seq가 홀수이면 쓰는 중이다.
+struct SlowOpSlot
+{
+    atomic_uint64_t seq{0};
+    SlowOp op;
+};
+
+struct SlowOpRing
+{
+    atomic_bool in_use{true};
+    pid_t tid = 0;
+    uint64_t head = 0; // 주인 thread만 사용
+    array<SlowOpSlot, SLOW_OP_RING_SIZE> slots;
+};
+
+// 종료한 thread의 ring도 dump 할 수 있도록 남겨두고 새 thread가 재사용한다.
+static mutex rings_lock;
+static vector<unique_ptr<SlowOpRing>> rings;
+static atomic_bool dump_requested{false};
+
+struct RingOwner
+{
+    SlowOpRing *ring = nullptr;
+    ~RingOwner()
+    {
+        if (ring != nullptr)
+            ring->in_use.store(false, memory_order_release);
+    }
+};
+
+static thread_local RingOwner t_ring;
+
+static SlowOpRing *get_ring()
+{
+    if (t_ring.ring != nullptr)
+        return t_ring.ring;
+    lock_guard<mutex> guard{rings_lock};
+    auto it = find_if(rings.begin(), rings.end(), [](auto &ring) { return false == ring->in_use.load(memory_order_acquire); });
+    if (it != rings.end())
+    {
+        t_ring.ring = it->get();
+        t_ring.ring->in_use.store(true, memory_order_relaxed);
+    }
+    else
+    {
+        rings.emplace_back(new SlowOpRing);
+        t_ring.ring = rings.back().get();
+    }
+    t_ring.ring->tid = current_tid();
+    return t_ring.ring;
+}
+
+void SlowOpProbe::record(uint64_t end_ns)
+{
+    auto ring = get_ring();
+    auto &slot = ring->slots[ring->head % SLOW_OP_RING_SIZE];
+    const auto seq = slot.seq.load(memory_order_relaxed);
+    slot.seq.store(seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    auto &rec = slot.op;
+    rec.start_ns = start_ns;
+    rec.latency_ns = end_ns - start_ns;
+    rec.key = key;
+    rec.bucket = bucket;
+    rec.epoch = current_epoch();
+    rec.steps = (uint32_t)(t_op_counters.steps - start_counters.steps);
+    rec.retries = (uint32_t)(t_op_counters.retries - start_counters.retries);
+    rec.init_buckets = (uint32_t)(t_op_counters.init_buckets - start_counters.init_buckets);
+    rec.node = current_node();
+    rec.tid = ring->tid;
+    rec.op = op;
+    slot.seq.store(seq + 2, memory_order_release);
+    ++ring->head;
+}
+
+vector<SlowOp> collect_slow_ops()
+{
+    vector<SlowOp> ops;
+    {
+        lock_guard<mutex> guard{rings_lock};
+        for (auto &ring : rings)
+        {
+            for (auto &slot : ring->slots)
+            {
+                const auto before = slot.seq.load(memory_order_acquire);
+                if (before == 0 || (before & 1) != 0)
+                    continue;
+                SlowOp op = slot.op;
+                atomic_thread_fence(memory_order_acquire);
+                // 읽는 동안 덮어쓰였으면 버린다.
+                if (slot.seq.load(memory_order_relaxed) == before)
+                    ops.push_back(op);
+            }
+        }
+    }
+    sort(ops.begin(), ops.end(), [](auto &a, auto &b) { return a.start_ns < b.start_ns; });
+    return ops;
+}
+
+static const char *op_name(SlowOpType op)
+{
+    switch (op)
+    {
+    case SlowOpType::INSERT:
+        return "insert";
+    case SlowOpType::REMOVE:
+        return "remove";
+    default:
+        return "find";
+    }
+}
+
+void dump_slow_ops(FILE *out)
+{
+    auto ops = collect_slow_ops();
+    fprintf(out, "%zu slow operations\n", ops.size());
+    for (auto &op : ops)
+    {
+        fprintf(out, "%llu %s key %lu bucket %lu latency %lluns steps %u retries %u init_bucket %u epoch %llu node %u tid %d\n",
+                (unsigned long long)op.start_ns, op_name(op.op), op.key, (unsigned long)op.bucket, (unsigned long long)op.latency_ns,
+                op.steps, op.retries, op.init_buckets, op.epoch, op.node, (int)op.tid);
+    }
+    fflush(out);
+}
+
+void clear_slow_ops()
+{
+    lock_guard<mutex> guard{rings_lock};
+    for (auto &ring : rings)
+    {
+        for (auto &slot : ring->slots)
+            slot.seq.store(0, memory_order_relaxed);
+    }
+}
+
+static void request_dump(int)
+{
+    dump_requested.store(true, memory_order_relaxed);
+}
+
+void dump_slow_ops_on_signal(int signo)
+{
+    struct sigaction action{};
+    action.sa_handler = request_dump;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(signo, &action, nullptr);
+}
+
+bool take_slow_op_dump_request()
+{
+    return dump_requested.load(memory_order_relaxed) && dump_requested.exchange(false, memory_order_relaxed);
+}
+
+} // namespace so
@@ -0,0 +1,109 @@
+#ifndef D4C7F2A9_8B1E_4E36_A5D0_3F9B6C2E1A58
+#define D4C7F2A9_8B1E_4E36_A5D0_3F9B6C2E1A58
+
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <sys/types.h>
+
+namespace so
+{
+
+// thread마다 최근의 느린 operation을 이만큼 기억한다. 넘치면 오래된 것부터 덮어쓴다.
+constexpr unsigned SLOW_OP_RING_SIZE = 256;
+
+enum class SlowOpType : uint8_t
+{
+    INSERT,
+    REMOVE,
+    FIND,
+};
+
+struct SlowOp
+{
+    uint64_t start_ns;   // steady_clock 기준 시작 시각
+    uint64_t latency_ns;
+    unsigned long key;
+    uintptr_t bucket;
+    unsigned long long epoch; // 끝났을 때의 reclamation epoch
+    uint32_t steps;           // list에서 지나간 노드 수
+    uint32_t retries;         // 실패한 CAS 수
+    uint32_t init_buckets;    // 새로 만든 dummy node 수 (init_bucket 재귀 포함)
+    unsigned node;
+    pid_t tid;
+    SlowOpType op;
+};
+
+// thread가 지금까지 한 일의 누적 값. probe는 시작할 때 복사해두고 느린 경우에만 차이를 계산한다.
+struct OpCounters
+{
+    uint64_t steps = 0;
+    uint64_t retries = 0;
+    uint64_t init_buckets = 0;
+};
+
+inline thread_local OpCounters t_op_counters;
+
+// traversal 중에는 지역 변수로 세고 끝날 때 한번만 t_op_counters에 더한다.
+struct StepCount
+{
+    uint64_t n = 0;
+    ~StepCount() { t_op_counters.steps += n; }
+};
+
+inline uint64_t flight_clock_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// operation 하나의 시간을 잰다. threshold_ns가 0이면 아무것도 하지 않고, 아니면 시작과 끝에 시각만 읽는다.
+// threshold_ns 이상 걸렸을 때만 현재 thread의 ring에 기록한다.
+class SlowOpProbe
+{
+public:
+    SlowOpProbe(uint64_t threshold_ns, SlowOpType op, unsigned long key) : threshold_ns{threshold_ns}, op{op}, key{key}
+    {
+        if (threshold_ns != 0)
+        {
+            start_counters = t_op_counters;
+            start_ns = flight_clock_ns();
+        }
+    }
+    ~SlowOpProbe()
+    {
+        if (threshold_ns == 0)
+            return;
+        const auto end_ns = flight_clock_ns();
+        if (end_ns - start_ns >= threshold_ns)
+            record(end_ns);
+    }
+    SlowOpProbe(const SlowOpProbe &) = delete;
+
+    void set_bucket(uintptr_t bucket) { this->bucket = bucket; }
+
+private:
+    uint64_t threshold_ns;
+    SlowOpType op;
+    unsigned long key;
+    uintptr_t bucket = 0;
+    uint64_t start_ns = 0;
+    OpCounters start_counters;
+
+    void record(uint64_t end_ns);
+};
+
+// 모든 thread의 ring에 남아 있는 느린 operation을 시작 시각 순서로 모은다. 종료한 thread의 것도 포함한다.
+std::vector<SlowOp> collect_slow_ops();
+void dump_slow_ops(FILE *out);
+void clear_slow_ops();
+// signo를 받으면 split-ordered table의 global helper가 다음 scan 때 stderr로 dump 한다.
+// signal handler 안에서는 flag만 세운다.
+void dump_slow_ops_on_signal(int signo = SIGUSR2);
+// dump 요청이 있었으면 지우고 true를 반환한다.
+bool take_slow_op_dump_request();
+
+} // namespace so
+
+#endif /* D4C7F2A9_8B1E_4E36_A5D0_3F9B6C2E1A58 */
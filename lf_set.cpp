@@ -1,46 +1,161 @@
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
 #include "lf_set.h"
+#include "bytes_node.h"
+#include "backoff.h"
+#include "flight_recorder.h"
+#include "stress_hooks.h"
+
+using namespace std;
+
+namespace so
+{
 
 struct EpochNode
 {
-    LFNODE *ptr;
+    void *ptr;
+    void (*free_fn)(void *);
     unsigned long long epoch;
 
-    EpochNode(LFNODE *ptr, unsigned long long epoch) : ptr{ptr}, epoch{epoch} {}
+    EpochNode(void *ptr, void (*free_fn)(void *), unsigned long long epoch) : ptr{ptr}, free_fn{free_fn}, epoch{epoch} {}
+};
+
+// erase_if/clear 처럼 한번에 많은 노드를 떼어낸 경우 노드마다 retire 하지 않고 batch 단위로 회수한다.
+struct EpochBatch
+{
+    vector<EpochNode> nodes;
+    unsigned long long epoch;
 };
 
+#ifdef SO_STRESS
+constexpr unsigned char POISON_HOME = 0xEE;
+bool stress_reclaim_check = false;
+atomic_size_t stress_bulk_reclaimed{0};
+atomic_size_t stress_poisoned_nodes{0};
+
+void stress_check_node(const LFNODE *node)
+{
+    if (node->home == POISON_HOME)
+    {
+        fprintf(stderr, "use after free: node %p (key %lx) was reclaimed\n", (const void *)node, node->key);
+        abort();
+    }
+}
+#endif
+
+static void free_node(LFNODE *node)
+{
+#ifdef SO_STRESS
+    // 해제된 메모리를 재사용하지 않도록 노드를 poison 한 채로 남겨둔다.
+    if (stress_reclaim_check)
+    {
+        node->home = POISON_HOME;
+        node->value = 0xDEADDEADDEADDEAD;
+        stress_poisoned_nodes.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+#endif
+    if (node->kind == NODE_BYTES)
+        free_bytes_node(node);
+    else
+        delete node;
+}
+
+static void free_node_fn(void *node)
+{
+    free_node(reinterpret_cast<LFNODE *>(node));
+}
+
 static atomic_ullong g_epoch{0};
 static atomic_ullong t_epochs[MAX_THREAD];
-thread_local vector<EpochNode> retired_list;
-thread_local unsigned counter{0};
+static atomic_bool t_slot_used[MAX_THREAD];
+static mutex bulk_lock;
+static vector<EpochBatch> bulk_list;
 constexpr unsigned epoch_freq = 100;
 constexpr unsigned empty_freq = 1000;
-static atomic_ullong tid_counter{0};
-thread_local unsigned tid = tid_counter.fetch_add(1, memory_order_relaxed);
 
-void retire(LFNODE *node)
+// thread가 종료되면 t_epochs slot을 반납하고, 아직 회수하지 못한 노드는 bulk_list로 넘긴다.
+// sweeper thread처럼 짧게 살다 가는 thread가 생겨도 slot이 겹치거나 노드가 새지 않도록 하기 위함.
+struct ThreadEpoch
 {
-    retired_list.emplace_back(node, g_epoch.load(memory_order_relaxed));
-    ++counter;
-    if (counter % epoch_freq == 0)
+    unsigned slot;
+    vector<EpochNode> retired_list;
+    unsigned counter{0};
+
+    ThreadEpoch()
     {
-        g_epoch.fetch_add(1, memory_order_relaxed);
+        for (slot = 0; slot < MAX_THREAD; ++slot)
+        {
+            bool expected = false;
+            if (t_slot_used[slot].compare_exchange_strong(expected, true))
+                break;
+        }
+        // 빈 slot을 기다리면 다른 thread가 끝나지 않는 한 영원히 멈추므로 바로 종료한다.
+        // thread_local 초기화 중이라 예외를 던져도 terminate 되기 때문에 이유를 남기고 abort 한다.
+        if (slot == MAX_THREAD)
+        {
+            fprintf(stderr, "so: more than %u threads are using the table at once (MAX_THREAD)\n", MAX_THREAD);
+            abort();
+        }
+        t_epochs[slot].store(ULLONG_MAX, memory_order_relaxed);
     }
-    if (counter % empty_freq == 0)
+
+    ~ThreadEpoch()
     {
-        auto min_epoch = ULLONG_MAX;
-        for (auto &epoch : t_epochs)
+        if (false == retired_list.empty())
         {
-            auto e = epoch.load(memory_order_acquire);
-            if (min_epoch > e)
+            EpochBatch batch{{}, 0};
+            for (auto &r_node : retired_list)
             {
-                min_epoch = e;
+                batch.epoch = max(batch.epoch, r_node.epoch);
             }
+            batch.nodes = move(retired_list);
+            lock_guard<mutex> guard{bulk_lock};
+            bulk_list.emplace_back(move(batch));
         }
+        t_epochs[slot].store(ULLONG_MAX, memory_order_release);
+        t_slot_used[slot].store(false, memory_order_release);
+    }
+};
+thread_local ThreadEpoch t_epoch;
+
+// 한번도 쓰이지 않은 slot은 0으로 남아 있으므로 건너뛴다. 그렇지 않으면 min이 항상 0이 되어 아무것도 회수하지 못한다.
+// slot을 막 잡은 thread의 epoch이 아직 0이어도 min이 작아질 뿐이므로 안전하다.
+static unsigned long long min_active_epoch()
+{
+    auto min_epoch = ULLONG_MAX;
+    for (unsigned i = 0; i < MAX_THREAD; ++i)
+    {
+        if (false == t_slot_used[i].load(memory_order_acquire))
+            continue;
+        auto e = t_epochs[i].load(memory_order_seq_cst);
+        if (min_epoch > e)
+        {
+            min_epoch = e;
+        }
+    }
+    return min_epoch;
+}
+
+void retire(void *ptr, void (*free_fn)(void *))
+{
+    auto &retired_list = t_epoch.retired_list;
+    auto &counter = t_epoch.counter;
+    retired_list.emplace_back(ptr, free_fn, g_epoch.load(memory_order_seq_cst));
+    ++counter;
+    if (counter % epoch_freq == 0)
+    {
+        g_epoch.fetch_add(1, memory_order_relaxed);
+    }
+    if (counter % empty_freq == 0)
+    {
+        auto min_epoch = min_active_epoch();
 
         auto removed_it = remove_if(retired_list.begin(), retired_list.end(), [min_epoch](auto &r_node) {
             if (r_node.epoch < min_epoch)
             {
-                delete r_node.ptr;
+                r_node.free_fn(r_node.ptr);
                 return true;
             }
             return false;
@@ -49,14 +164,82 @@ void retire(LFNODE *node)
     }
 }
 
+static void retire(LFNODE *node)
+{
+    retire(node, free_node_fn);
+}
+
+void retire_bulk(vector<LFNODE *> &&nodes)
+{
+    if (nodes.empty())
+        return;
+    auto epoch = g_epoch.fetch_add(1, memory_order_seq_cst);
+    EpochBatch batch{{}, epoch};
+    batch.nodes.reserve(nodes.size());
+    for (auto node : nodes)
+    {
+        batch.nodes.emplace_back(node, free_node_fn, epoch);
+    }
+    lock_guard<mutex> guard{bulk_lock};
+    bulk_list.push_back(move(batch));
+}
+
+void retire_bulk(void *ptr, void (*free_fn)(void *))
+{
+    auto epoch = g_epoch.fetch_add(1, memory_order_seq_cst);
+    EpochBatch batch{{}, epoch};
+    batch.nodes.emplace_back(ptr, free_fn, epoch);
+    lock_guard<mutex> guard{bulk_lock};
+    bulk_list.push_back(move(batch));
+}
+
+unsigned long long current_epoch()
+{
+    return g_epoch.load(memory_order_relaxed);
+}
+
+size_t reclaim_bulk()
+{
+    vector<EpochBatch> freeable;
+    auto min_epoch = min_active_epoch();
+    {
+        lock_guard<mutex> guard{bulk_lock};
+        auto removed_it = partition(bulk_list.begin(), bulk_list.end(), [min_epoch](auto &batch) {
+            return batch.epoch >= min_epoch;
+        });
+        move(removed_it, bulk_list.end(), back_inserter(freeable));
+        bulk_list.erase(removed_it, bulk_list.end());
+    }
+
+    size_t freed = 0;
+    for (auto &batch : freeable)
+    {
+        for (auto &node : batch.nodes)
+        {
+            node.free_fn(node.ptr);
+        }
+        freed += batch.nodes.size();
+    }
+#ifdef SO_STRESS
+    stress_bulk_reclaimed.fetch_add(freed, memory_order_relaxed);
+#endif
+    return freed;
+}
+
+unsigned thread_slot()
+{
+    return t_epoch.slot;
+}
+
+// 회수하는 thread가 epoch을 보기 전에 list를 읽지 않도록 seq_cst로 알린다.
 void start_op()
 {
-    t_epochs[tid % MAX_THREAD].store(g_epoch.load(memory_order_relaxed), memory_order_release);
+    t_epochs[t_epoch.slot].store(g_epoch.load(memory_order_seq_cst), memory_order_seq_cst);
 }
 
 void end_op()
 {
-    t_epochs[tid % MAX_THREAD].store(ULLONG_MAX, memory_order_release);
+    t_epochs[t_epoch.slot].store(ULLONG_MAX, memory_order_release);
 }
 
 LFSET::LFSET() : head{0, 0}
@@ -69,7 +252,12 @@ void LFSET::Init()
     {
         LFNODE *temp = head.GetNext();
         head.next = temp->next;
-        delete temp;
+#ifdef SO_COMPACT_REFS
+        // dummy node는 table의 DummyArena가 한번에 해제한다.
+        if ((temp->key & 0x1) == 0)
+            continue;
+#endif
+        free_node(temp);
     }
 }
 
@@ -87,128 +275,250 @@ void LFSET::Dump()
     cout << endl;
 }
 
-bool LFSET::Find(LFNODE& from, unsigned long x, LFNODE **pred, LFNODE **curr)
+// list 순서에서 node가 찾는 item보다 앞이면 음수, 같은 item이면 0, 뒤면 양수를 돌려주는 비교 함수.
+// 같은 split-ordered key의 byte string 노드는 정수 노드보다 뒤에 있는 것으로 본다.
+static auto plain_compare(unsigned long x)
 {
-    start_op();
+    return [x](const LFNODE &node) {
+        if (node.key != x)
+            return node.key < x ? -1 : 1;
+        return node.kind == NODE_PLAIN ? 0 : 1;
+    };
+}
+
+static auto bytes_compare(const BytesKey &key)
+{
+    return [&key](const LFNODE &node) { return compare_bytes(node, key); };
+}
+
+// list 순서에서 node가 mark보다 앞이거나 같은 자리이면 true
+static bool not_after(const LFNODE &node, const LFNODE &mark)
+{
+    if (mark.kind == NODE_BYTES)
+        return compare_bytes(node, BytesKey{mark.key, mark.value, bytes_key(mark)}) <= 0;
+    return plain_compare(mark.key)(node) <= 0;
+}
+
+// 만료된 노드를 mark 해서 지워진 것으로 만든다. unlink와 retire는 이후의 traversal이 한다.
+static bool expire_if_due(LFNODE *node)
+{
+    if (false == is_expired(*node))
+        return false;
+    node->TryMark(node->GetNext());
+    return true;
+}
+
+// start_op()/end_op() 사이에서만 호출해야 한다. MultiUpdate처럼 여러 key를 찾는 동안 앞에서 찾은 노드가
+// 회수되지 않도록 epoch은 호출한 쪽에서 관리한다.
+// start부터 찾는다. start는 from 또는 같은 epoch 안에서 찾은 from 뒤의 노드이다.
+// unlink가 실패해도 pred가 mark되지 않았으면 아직 list에 있으므로 bucket 처음이 아니라 pred부터 다시 본다.
+template <typename Compare>
+static bool find_node(LFNODE &from, LFNODE *start, const Compare &compare, LFNODE **pred, LFNODE **curr, Backoff &backoff)
+{
+    StepCount steps;
 retry:
-    *pred = &from;
+    *pred = start;
     *curr = (*pred)->GetNext();
     while (true)
     {
         if (*curr == nullptr)
             return false;
+        SO_CHECK_NODE(*curr);
+        remote_access((*curr)->home);
         bool removed;
         LFNODE *su = (*curr)->GetNextWithMark(&removed);
         if (true == removed)
         {
+            SO_PERTURB();
             if (false == (*pred)->CAS(*curr, su, false, false))
-                goto retry;
+            {
+                backoff.failed((*pred)->home);
+                if ((*pred)->IsMarked())
+                {
+                    start = &from;
+                    goto retry;
+                }
+                *curr = (*pred)->GetNext();
+                continue;
+            }
+            backoff.succeeded();
             retire(*curr);
         }
-        else if ((*curr)->key >= x)
-        {
-            return ((*curr)->key == x);
-        }
         else
         {
+            int order = compare(**curr);
+            if (order == 0 && expire_if_due(*curr))
+            {
+                start = &from;
+                goto retry;
+            }
+            if (order >= 0)
+                return order == 0;
             *pred = *curr;
         }
         *curr = (*curr)->GetNext();
+        ++steps.n;
+        SO_PERTURB();
     }
 }
 
-LFNODE *LFSET::Add(LFNODE& from, unsigned long x, unsigned long value)
+template <typename Compare>
+static bool find_node(LFNODE &from, const Compare &compare, LFNODE **pred, LFNODE **curr)
+{
+    Backoff backoff;
+    return find_node(from, &from, compare, pred, curr, backoff);
+}
+
+// CAS가 실패한 뒤 다시 찾기 시작할 곳. 같은 epoch 안에서만 pred를 다시 쓸 수 있다.
+static LFNODE *resume_point(LFNODE &from, LFNODE *pred)
+{
+    return pred->IsMarked() ? &from : pred;
+}
+
+template <typename Compare>
+static bool add_node(LFNODE &from, LFNODE &node, const Compare &compare)
 {
     LFNODE *pred, *curr;
-    LFNODE *e = new LFNODE(x, value);
+    LFNODE *start = &from;
+    Backoff backoff;
+    start_op();
     while (true)
     {
-        if (true == Find(from, x, &pred, &curr))
+        if (true == find_node(from, start, compare, &pred, &curr, backoff))
         {
             end_op();
-            delete e;
-            return curr;
+            return false;
         }
-        else
+        node.SetNext(curr);
+        SO_PERTURB();
+        if (false == pred->CAS(curr, &node, false, false))
         {
-            e->SetNext(curr);
-            if (false == pred->CAS(curr, e, false, false))
-            {
-                end_op();
-                continue;
-            }
-            end_op();
-            return e;
+            backoff.failed(pred->home);
+            start = resume_point(from, pred);
+            continue;
         }
+        backoff.succeeded();
+        end_op();
+        return true;
     }
 }
 
-bool LFSET::Add(LFNODE& from,LFNODE &node)
+template <typename Compare>
+static bool remove_node(LFNODE &from, const Compare &compare)
 {
     LFNODE *pred, *curr;
+    LFNODE *start = &from;
+    Backoff backoff;
+    start_op();
     while (true)
     {
-        if (true == Find(from, node.key, &pred, &curr))
+        if (false == find_node(from, start, compare, &pred, &curr, backoff))
         {
             end_op();
             return false;
         }
-        else
+        LFNODE *succ = curr->GetNext();
+        SO_PERTURB();
+        if (false == curr->TryMark(succ))
         {
-            node.SetNext(curr);
-            if (false == pred->CAS(curr, &node, false, false))
-            {
-                end_op();
-                continue;
-            }
-            end_op();
-            return true;
+            backoff.failed(curr->home);
+            start = resume_point(from, pred);
+            continue;
         }
+        backoff.succeeded();
+        SO_PERTURB();
+        if (true == pred->CAS(curr, succ, false, false))
+        {
+            retire(curr);
+        }
+        end_op();
+        return true;
     }
 }
 
-bool LFSET::Remove(LFNODE& from,unsigned long x)
+// curr부터 따라가며 찾은 노드. start_op()/end_op() 사이에서만 호출해야 한다.
+// MultiUpdate의 UPDATE는 mark된 옛 노드 바로 뒤에 새 노드를 두므로 mark된 같은 key의 노드는 건너뛴다.
+template <typename Compare>
+static LFNODE *search_node(LFNODE *curr, const Compare &compare)
+{
+    int order = 1;
+    StepCount steps;
+    while (curr != nullptr && ((order = compare(*curr)) < 0 || (order == 0 && curr->IsMarked())))
+    {
+        SO_CHECK_NODE(curr);
+        remote_access(curr->home);
+        curr = curr->GetNext();
+        ++steps.n;
+        SO_PERTURB();
+    }
+    if (curr == nullptr || order != 0 || expire_if_due(curr))
+        return nullptr;
+    if (curr->referenced.load(memory_order_relaxed) == 0)
+        curr->referenced.store(1, memory_order_relaxed);
+    return curr;
+}
+
+bool LFSET::Find(LFNODE& from, unsigned long x, LFNODE **pred, LFNODE **curr)
+{
+    start_op();
+    return find_node(from, plain_compare(x), pred, curr);
+}
+
+LFNODE *LFSET::Add(LFNODE& from, unsigned long x, unsigned long value)
+{
+    LFNODE *e = new LFNODE(x, value);
+    e->home = current_node();
+    auto added = AddOrGet(from, *e);
+    if (added != e)
+        delete e;
+    return added;
+}
+
+LFNODE *LFSET::AddOrGet(LFNODE& from, LFNODE &node)
 {
     LFNODE *pred, *curr;
+    LFNODE *e = &node;
+    LFNODE *start = &from;
+    Backoff backoff;
+    const auto compare = plain_compare(node.key);
+    start_op();
     while (true)
     {
-        if (false == Find(from, x, &pred, &curr))
+        if (true == find_node(from, start, compare, &pred, &curr, backoff))
         {
             end_op();
-            return false;
+            return curr;
         }
-        else
+        e->SetNext(curr);
+        SO_PERTURB();
+        if (false == pred->CAS(curr, e, false, false))
         {
-            LFNODE *succ = curr->GetNext();
-            if (false == curr->TryMark(succ))
-            {
-                end_op();
-                continue;
-            }
-            if (true == pred->CAS(curr, succ, false, false))
-            {
-                retire(curr);
-            }
-            end_op();
-            return true;
+            backoff.failed(pred->home);
+            start = resume_point(from, pred);
+            continue;
         }
+        backoff.succeeded();
+        end_op();
+        return e;
     }
 }
 
+bool LFSET::Add(LFNODE& from,LFNODE &node)
+{
+    return add_node(from, node, plain_compare(node.key));
+}
+
+bool LFSET::Remove(LFNODE& from,unsigned long x)
+{
+    return remove_node(from, plain_compare(x));
+}
+
 optional<unsigned long> LFSET::Contains(unsigned long x)
 {
     start_op();
     optional<unsigned long> ret;
-    LFNODE *curr = head.GetNext();
-    while (curr != nullptr && curr->key < x)
-    {
-        curr = curr->GetNext();
-    }
-
-    if (curr != nullptr && (false == curr->IsMarked()) && (x == curr->key))
-    {
-        ret = curr->value;
-    }
+    if (auto node = search_node(head.GetNext(), plain_compare(x)))
+        ret = node->value;
     end_op();
     return ret;
 }
@@ -217,20 +527,234 @@ optional<unsigned long> LFSET::Contains(LFNODE &from, unsigned long x)
 {
     start_op();
     optional<unsigned long> ret;
-    LFNODE *curr = &from;
-    while (curr != nullptr && curr->key < x)
+    if (auto node = search_node(&from, plain_compare(x)))
+        ret = node->value;
+    end_op();
+    return ret;
+}
+
+bool LFSET::AddBytes(LFNODE &from, LFNODE &node)
+{
+    BytesKey key{node.key, node.value, bytes_key(node)};
+    return add_node(from, node, bytes_compare(key));
+}
+
+bool LFSET::RemoveBytes(LFNODE &from, const BytesKey &key)
+{
+    return remove_node(from, bytes_compare(key));
+}
+
+optional<string> LFSET::ContainsBytes(LFNODE &from, const BytesKey &key)
+{
+    start_op();
+    optional<string> ret;
+    // 노드가 회수되지 않도록 end_op() 전에 value를 복사한다.
+    if (auto node = search_node(&from, bytes_compare(key)))
+        ret.emplace(bytes_value(*node));
+    end_op();
+    return ret;
+}
+
+// MCAS가 바꿀 word 하나. node->next를 old_next에서 (chain의 첫 노드 또는 old_next) + mark로 바꾼다.
+struct WordPlan
+{
+    LFNODE *node;
+    uintptr_t old_next;
+    bool mark;
+    vector<LFNODE *> chain; // node와 old_next 사이에 끼워 넣을 새 노드들 (key 순서)
+};
+
+static void free_descriptor(void *desc)
+{
+    delete reinterpret_cast<McasDescriptor *>(desc);
+}
+
+bool LFSET::MultiUpdate(vector<pair<LFNODE *, MultiOp>> ops)
+{
+    if (ops.size() > MCAS_MAX_WORDS)
+        throw invalid_argument("too many keys for a multi-key update");
+    sort(ops.begin(), ops.end(), [](auto &a, auto &b) { return a.second.key < b.second.key; });
+    if (adjacent_find(ops.begin(), ops.end(), [](auto &a, auto &b) { return a.second.key == b.second.key; }) != ops.end())
+        throw invalid_argument("duplicated key in a multi-key update");
+
+    while (true)
     {
-        curr = curr->GetNext();
+        vector<WordPlan> plans;
+        plans.reserve(ops.size());
+        vector<LFNODE *> created;
+        bool consistent = true;
+        bool satisfied = true;
+        // 같은 word를 바꾸는 op들은 plan 하나로 합친다. 서로 다른 시점에 읽은 old_next가 다르면 처음부터 다시.
+        auto plan_for = [&](LFNODE *node, uintptr_t old_next) -> WordPlan * {
+            for (auto &plan : plans)
+            {
+                if (plan.node != node)
+                    continue;
+                if (plan.old_next != old_next)
+                    consistent = false;
+                return &plan;
+            }
+            plans.push_back(WordPlan{node, old_next, false, {}});
+            return &plans.back();
+        };
+
+        start_op();
+        for (auto &[from, op] : ops)
+        {
+            LFNODE *pred, *curr;
+            bool found = find_node(*from, plain_compare(op.key), &pred, &curr);
+            if (found == (op.type == MultiOpType::INSERT))
+            {
+                satisfied = false;
+                break;
+            }
+            if (op.type == MultiOpType::INSERT)
+            {
+                auto node = new LFNODE{op.key, op.value};
+                node->home = current_node();
+                created.push_back(node);
+                plan_for(pred, reinterpret_cast<uintptr_t>(curr))->chain.push_back(node);
+                continue;
+            }
+
+            bool removed;
+            LFNODE *succ = curr->GetNextWithMark(&removed);
+            auto plan = plan_for(curr, reinterpret_cast<uintptr_t>(succ));
+            if (true == removed)
+                consistent = false;
+            plan->mark = true;
+            if (op.type == MultiOpType::UPDATE)
+            {
+                // 옛 노드를 mark 하면서 바로 뒤에 새 노드를 붙인다. 옛 노드는 다음 Find가 unlink 한다.
+                auto node = new LFNODE{op.key, op.value};
+                node->home = current_node();
+                created.push_back(node);
+                plan->chain.insert(plan->chain.begin(), node);
+            }
+            if (false == consistent)
+                break;
+        }
+
+        bool done = false;
+        if (satisfied && consistent)
+        {
+            auto desc = new McasDescriptor;
+            for (auto &plan : plans)
+            {
+                uintptr_t new_next = plan.old_next;
+                for (auto it = plan.chain.rbegin(); it != plan.chain.rend(); ++it)
+                {
+                    (*it)->SetNext(reinterpret_cast<LFNODE *>(new_next));
+                    new_next = reinterpret_cast<uintptr_t>(*it);
+                }
+                if (plan.mark)
+                    new_next |= 1;
+                desc->add(reinterpret_cast<atomic_uintptr_t *>(&plan.node->next), plan.old_next, new_next);
+            }
+            done = mcas(desc);
+            retire(desc, free_descriptor);
+        }
+        end_op();
+
+        if (done)
+            return true;
+        // 실패한 MCAS는 새 노드를 한번도 공개하지 않으므로 바로 해제해도 된다.
+        for (auto node : created)
+        {
+            delete node;
+        }
+        if (false == satisfied)
+            return false;
     }
+}
 
-    if (curr != nullptr && (false == curr->IsMarked()) && (x == curr->key))
+size_t LFSET::EraseIf(LFNODE &from, unsigned long last_key, const function<bool(const LFNODE &)> &pred,
+                      const function<void(const LFNODE &, bool)> &on_mark)
+{
+    constexpr unsigned refresh_freq = 1024;
+    size_t erased = 0;
+    unsigned steps = 0;
+    vector<LFNODE *> unlinked;
+    Backoff backoff;
+    // 마지막으로 pred를 부른 노드. 처음부터 다시 훑을 때는 이 노드까지 pred를 다시 부르지 않는다.
+    // (pred가 상태를 가질 수 있으므로 한 노드는 한번만 판정한다.) epoch을 갱신하는 것은 dummy node에서
+    // 판정한 직후뿐이므로 이 노드는 항상 현재 epoch에서 보호된다.
+    const LFNODE *judged = nullptr;
+    bool replaying = false;
+    start_op();
+retry:
+    LFNODE *prev = &from;
+    LFNODE *curr = prev->GetNext();
+    while (curr != nullptr && curr->key <= last_key)
     {
-        ret = curr->value;
+        SO_CHECK_NODE(curr);
+        bool removed;
+        LFNODE *succ = curr->GetNextWithMark(&removed);
+        if (true == replaying)
+            replaying = not_after(*curr, *judged);
+        if (false == removed && false == replaying)
+        {
+            judged = curr;
+            if (pred(*curr))
+            {
+                SO_PERTURB();
+                // succ가 바뀌어 mark에 실패하면 pred는 다시 부르지 않고 새 succ로 mark만 다시 시도한다.
+                while (false == curr->TryMark(succ))
+                {
+                    succ = curr->GetNextWithMark(&removed);
+                    if (true == removed)
+                        break;
+                }
+                // 그 사이 다른 thread가 지웠으면 이 sweep이 지운 것이 아니다.
+                if (on_mark)
+                    on_mark(*curr, false == removed);
+                if (false == removed)
+                {
+                    ++erased;
+                    removed = true;
+                }
+            }
+        }
+        if (true == removed)
+        {
+            SO_PERTURB();
+            if (false == prev->CAS(curr, succ, false, false))
+            {
+                backoff.failed(prev->home);
+                // prev가 아직 list에 있으면 거기서부터 다시 본다.
+                if (prev->IsMarked())
+                {
+                    replaying = judged != nullptr;
+                    goto retry;
+                }
+                curr = prev->GetNext();
+                continue;
+            }
+            unlinked.push_back(curr);
+        }
+        else
+        {
+            prev = curr;
+            // dummy node는 삭제되지 않으므로 여기서는 epoch을 갱신해도 prev가 안전하다.
+            // 긴 sweep 동안 다른 thread들의 회수가 막히지 않도록 주기적으로 갱신.
+            if (++steps % refresh_freq == 0 && (prev->key & 0x1) == 0)
+            {
+                end_op();
+                start_op();
+                // succ는 이전 epoch에서 읽었으므로 이미 회수되었을 수 있다. prev에서 다시 읽는다.
+                curr = prev->GetNext();
+                continue;
+            }
+        }
+        curr = succ;
     }
     end_op();
-    return ret;
+    retire_bulk(move(unlinked));
+    return erased;
 }
 
 LFSET::~LFSET() {
     this->Init();
 }
+
+} // namespace so
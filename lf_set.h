@@ -12,26 +12,50 @@
 #include <climits>
 #include <algorithm>
 #include <optional>
+#include <functional>
+#include <string>
+#include "topology.h"
+#include "mcas.h"
+#include "so_config.h"
 
-using namespace std;
+namespace so
+{
 
+// table을 동시에 쓰는 thread 수의 상한. 넘으면 새 thread가 처음 table을 쓸 때 메시지를 남기고 abort 한다.
 constexpr unsigned MAX_THREAD = 128;
 constexpr uintptr_t WITH_MARK = -1;
 constexpr uintptr_t POINTER_ONLY = -2;
 
+// LFNODE::kind. 같은 split-ordered key 안에서는 NODE_PLAIN 노드가 NODE_BYTES 노드보다 앞에 온다.
+constexpr unsigned char NODE_PLAIN = 0;
+constexpr unsigned char NODE_BYTES = 1; // key/value가 byte string (bytes_node.h)
+
 class LFNODE
 {
 public:
     unsigned long key;
     unsigned long value;
     bool is_new; // dummy node일 경우에만 의미가 있음.
+    unsigned char home; // 노드를 만든 thread의 (가상) NUMA node
+    unsigned char kind;
+    mutable std::atomic<unsigned char> referenced; // find가 찾으면 1, cache sweeper가 CLOCK second chance로 지운다
+    uint32_t expire_at; // ttl_clock_ms() 기준 만료 시각. 0이면 만료되지 않음
     LFNODE *next;
 
-    LFNODE(unsigned long key, unsigned long value) : key{ key }, next{ nullptr }, value{ value }, is_new{ true } {}
+    LFNODE(unsigned long key, unsigned long value) : key{ key }, next{ nullptr }, value{ value }, is_new{ true }, home{ 0 }, kind{ NODE_PLAIN }, referenced{ 0 }, expire_at{ 0 } {}
+
+    // 진행 중인 MCAS가 있으면 끝내주고 값을 읽는다. descriptor가 없으면 보통 load와 같다.
+    uintptr_t LoadNext()
+    {
+        uintptr_t temp = (uintptr_t)next;
+        if (0 != (temp & DESCRIPTOR_BITS))
+            temp = mcas_read(reinterpret_cast<std::atomic_uintptr_t *>(&next));
+        return temp;
+    }
 
     LFNODE *GetNext()
     {
-        return reinterpret_cast<LFNODE *>((uintptr_t)next & POINTER_ONLY);
+        return reinterpret_cast<LFNODE *>(LoadNext() & POINTER_ONLY);
     }
 
     void SetNext(LFNODE *ptr)
@@ -41,7 +65,7 @@ public:
 
     LFNODE *GetNextWithMark(bool *mark)
     {
-        uintptr_t temp = (uintptr_t)next;
+        uintptr_t temp = LoadNext();
         *mark = temp & 1;
         return reinterpret_cast<LFNODE *>(temp & POINTER_ONLY);
     }
@@ -49,7 +73,7 @@ public:
     bool CAS(uintptr_t old_value, uintptr_t new_value)
     {
         return atomic_compare_exchange_strong(
-            reinterpret_cast<atomic_uintptr_t *>(&next),
+            reinterpret_cast<std::atomic_uintptr_t *>(&next),
             &old_value, new_value);
     }
 
@@ -77,10 +101,45 @@ public:
 
     bool IsMarked()
     {
-        return (0 != ((uintptr_t)next & 1));
+        return (0 != (LoadNext() & 1));
     }
 };
 
+struct BytesKey;
+
+enum class MultiOpType : uint8_t
+{
+    INSERT, // key가 없어야 함
+    REMOVE, // key가 있어야 함
+    UPDATE, // key가 있어야 하고, value를 바꾼 새 노드로 교체한다
+};
+
+struct MultiOp
+{
+    MultiOpType type;
+    unsigned long key;
+    unsigned long value;
+};
+
+// 32bit로 wrap 되는 millisecond 시계. 차이로만 비교하므로 TTL은 TTL_MAX_MS를 넘을 수 없다.
+constexpr uint32_t TTL_MAX_MS = INT32_MAX;
+
+inline uint32_t ttl_clock_ms()
+{
+    return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline uint32_t ttl_expire_at(std::chrono::milliseconds ttl)
+{
+    auto expire_at = ttl_clock_ms() + (uint32_t)std::min<long long>(std::max<long long>(ttl.count(), 1), TTL_MAX_MS);
+    return expire_at == 0 ? 1 : expire_at;
+}
+
+inline bool is_expired(const LFNODE &node)
+{
+    return node.expire_at != 0 && (int32_t)(node.expire_at - ttl_clock_ms()) <= 0;
+}
+
 class LFSET
 {
     LFNODE head;
@@ -93,13 +152,40 @@ public:
     bool Find(LFNODE &from, unsigned long x, LFNODE **pred, LFNODE **curr);
     // 성공하면 삽입된 노드 pointer 반환, 실패하면 이미 삽입된 노드의 pointer 반환
     LFNODE *Add(LFNODE &from, unsigned long x, unsigned long value = 0);
+    // 이미 만든 node를 넣는다. 같은 key의 노드가 있으면 넣지 않고 그 노드를 반환하며 node는 호출한 쪽에서 해제한다.
+    LFNODE *AddOrGet(LFNODE &from, LFNODE &node);
     bool Add(LFNODE &from, LFNODE &node);
     bool Remove(LFNODE &from, unsigned long x);
-    optional<unsigned long> Contains(unsigned long x);
-    optional<unsigned long> Contains(LFNODE &from, unsigned long x);
+    std::optional<unsigned long> Contains(unsigned long x);
+    std::optional<unsigned long> Contains(LFNODE &from, unsigned long x);
+    // byte string key용. node는 new_bytes_node()로 만든 노드이고, 실패하면 호출한 쪽에서 해제한다.
+    bool AddBytes(LFNODE &from, LFNODE &node);
+    bool RemoveBytes(LFNODE &from, const BytesKey &key);
+    std::optional<std::string> ContainsBytes(LFNODE &from, const BytesKey &key);
+    // (시작 노드, split-ordered key로 바꾼 op) 목록을 MCAS 한번으로 모두 적용하거나 하나도 적용하지 않는다.
+    // key는 서로 달라야 하고, 조건을 만족하지 않는 op가 있으면 false
+    bool MultiUpdate(std::vector<std::pair<LFNODE *, MultiOp>> ops);
+    // from 다음부터 key가 last_key 이하인 노드 중 pred를 만족하는 노드를 mark 후 unlink. 삭제한 노드 수 반환
+    // pred는 노드마다 한번만 부른다. (CLOCK bit를 지우는 것처럼 상태를 바꾸는 pred도 쓸 수 있다)
+    // on_mark가 있으면 pred가 true인 노드마다 mark를 시도한 직후 이 호출이 mark 했는지와 함께 호출한다.
+    // (pred에서 잡은 자원을 on_mark에서 놓을 수 있다)
+    size_t EraseIf(LFNODE &from, unsigned long last_key, const std::function<bool(const LFNODE &)> &pred,
+                   const std::function<void(const LFNODE &, bool)> &on_mark = {});
     LFNODE& get_head() {return head;}
 };
 
 void start_op();
+// 노드가 아닌 object(MCAS descriptor 등)를 epoch 기반으로 회수
+void retire(void *ptr, void (*free_fn)(void *));
 void end_op();
+// 현재 thread가 사용하는 epoch slot 번호. 살아있는 thread끼리는 겹치지 않는다 (0 ~ MAX_THREAD-1)
+unsigned thread_slot();
+// 떼어낸 노드들을 한 epoch으로 묶어서 retire. 실제 해제는 reclaim_bulk()에서 일어난다.
+void retire_bulk(std::vector<LFNODE *> &&nodes);
+// 노드가 아닌 큰 object를 bulk list로 retire. global helper의 reclaim_bulk()에서 해제된다.
+void retire_bulk(void *ptr, void (*free_fn)(void *));
+size_t reclaim_bulk();
+unsigned long long current_epoch();
+} // namespace so
+
 #endif /* CDC7572F_E1AD_4B7D_B182_4CA81AA68BB4 */
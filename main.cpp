@@ -1,8 +1,14 @@
 #include <random>
 #include <chrono>
+#include <cstring>
+#include <unistd.h>
 #include "lf_set.h"
 #include "split_ordered.h"
 #include "rand_seeds.h"
+#include "trace.h"
+#include "flight_recorder.h"
+#include "topology.h"
+#include "perf_counters.h"
 static const int NUM_TEST = 4'000'000;
 
 #ifndef WRITE_RATIO
@@ -11,8 +17,53 @@ static const int NUM_TEST = 4'000'000;
 
 using namespace std;
 using namespace chrono;
+using namespace so;
 
-void benchmark(SO_Hashtable& my_table, int num_thread, int tid)
+// worker thread를 tid 순서대로 core_per_node개씩 node에 배치하고 그 node에 고정한다.
+void place_worker(int tid, unsigned node_num)
+{
+    set_current_node((tid / numa_topology().core_per_node) % node_num);
+    pin_thread();
+}
+
+// sample이 주어지면 생성부터 소멸까지 현재 thread의 hardware counter를 센다.
+class ThreadPerf
+{
+public:
+    explicit ThreadPerf(PerfSample *sample) : sample{sample}
+    {
+        if (sample != nullptr && counters.open(0))
+            counters.enable();
+    }
+    ~ThreadPerf()
+    {
+        if (sample != nullptr)
+        {
+            counters.disable();
+            *sample = counters.read();
+        }
+    }
+
+private:
+    PerfSample *sample;
+    PerfCounters counters;
+};
+
+void prefill(SO_Hashtable& my_table, int num_thread, int tid, unsigned node_num, unsigned long count, PerfSample *sample)
+{
+    place_worker(tid, node_num);
+    ThreadPerf perf{sample};
+    for (unsigned long i = tid; i < count; i += num_thread)
+    {
+#ifdef RANGE_LIMIT
+        my_table.insert(i % RANGE_LIMIT, i);
+#else
+        my_table.insert(i, i);
+#endif
+    }
+}
+
+void benchmark(SO_Hashtable& my_table, int num_thread, int tid, unsigned node_num, PerfSample *sample)
 {
     mt19937_64 rng{rand_seeds[tid]};
 #ifdef RANGE_LIMIT
@@ -22,7 +73,8 @@ void benchmark(SO_Hashtable& my_table, int num_thread, int tid)
 #endif
     uniform_int_distribution<unsigned long> cmd_dist{0, 99};
 
-    pin_thread();
+    place_worker(tid, node_num);
+    ThreadPerf perf{sample};
     for (int i = 0; i < NUM_TEST / num_thread; ++i)
     {
         if (cmd_dist(rng) < WRITE_RATIO) {
@@ -39,39 +91,217 @@ void benchmark(SO_Hashtable& my_table, int num_thread, int tid)
     }
 }
 
+void replay(SO_Hashtable& my_table, const TraceReader& trace, int num_thread, int tid, unsigned node_num, bool paced, steady_clock::time_point start_t, PerfSample *sample)
+{
+    place_worker(tid, node_num);
+    ThreadPerf perf{sample};
+    replay_trace(my_table, trace, tid, num_thread, paced, start_t);
+}
+
+// phase 하나 동안 모든 helper thread의 counter를 센다.
+class HelperPerf
+{
+public:
+    HelperPerf(bool enabled, const SO_Hashtable &table)
+    {
+        if (!enabled)
+            return;
+        for (auto tid : table.helper_tids())
+        {
+            counters.emplace_back(new PerfCounters);
+            counters.back()->open(tid);
+        }
+    }
+    void start()
+    {
+        for (auto &c : counters)
+            c->enable();
+    }
+    vector<PerfSample> stop()
+    {
+        vector<PerfSample> samples;
+        for (auto &c : counters)
+        {
+            c->disable();
+            samples.push_back(c->read());
+        }
+        return samples;
+    }
+
+private:
+    vector<unique_ptr<PerfCounters>> counters;
+};
+
+void report_perf(const char *phase, uint64_t op_num, unsigned node_num, const vector<PerfSample> &workers, const vector<PerfSample> &helpers)
+{
+    PerfSample total;
+    for (unsigned i = 0; i < workers.size(); ++i)
+    {
+        printf("[%s] worker %u: %s\n", phase, i, workers[i].per_op(op_num / workers.size()).c_str());
+        total += workers[i];
+    }
+    printf("[%s] workers: %s\n", phase, total.per_op(op_num).c_str());
+    // helper의 비용도 worker가 실행한 연산 수로 나눠서 연산 하나가 유발한 helper 작업량으로 본다.
+    total = PerfSample{};
+    for (unsigned i = 0; i < helpers.size(); ++i)
+    {
+        string name = i == 0 ? "global helper" : i <= node_num ? "local helper " + to_string(i - 1) : "owner " + to_string(i - 1 - node_num);
+        printf("[%s] %s: %s\n", phase, name.c_str(), helpers[i].per_op(op_num).c_str());
+        total += helpers[i];
+    }
+    printf("[%s] helpers: %s\n", phase, total.per_op(op_num).c_str());
+}
+
 int main(int argc, char *argv[])
 {
     if (argc < 2)
     {
-        fprintf(stderr, "you have to give a thread num\n");
+        fprintf(stderr, "usage: %s <thread num> [--record <trace>] [--replay <trace>] [--paced] [--virtual-nodes <n>] [--remote-delay <ns>] [--prefill <n>] [--perf] [--engine so|nr|shm] [--shm-name <name>] [--delegate <owners per node>] [--partial] [--slow-op-ns <ns>]\n", argv[0]);
         exit(-1);
     }
     unsigned num_thread = atoi(argv[1]);
+    const char *record_path = nullptr;
+    const char *replay_path = nullptr;
+    bool paced = false;
+    unsigned virtual_nodes = 0;
+    unsigned remote_delay = 0;
+    unsigned long prefill_num = 0;
+    bool perf = false;
+    SO_Options options;
+    for (int i = 2; i < argc; ++i)
+    {
+        if (0 == strcmp(argv[i], "--record") && i + 1 < argc)
+            record_path = argv[++i];
+        else if (0 == strcmp(argv[i], "--replay") && i + 1 < argc)
+            replay_path = argv[++i];
+        else if (0 == strcmp(argv[i], "--paced"))
+            paced = true;
+        else if (0 == strcmp(argv[i], "--virtual-nodes") && i + 1 < argc)
+            virtual_nodes = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "--remote-delay") && i + 1 < argc)
+            remote_delay = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "--prefill") && i + 1 < argc)
+            prefill_num = atol(argv[++i]);
+        else if (0 == strcmp(argv[i], "--perf"))
+            perf = true;
+        else if (0 == strcmp(argv[i], "--engine") && i + 1 < argc)
+        {
+            ++i;
+            options.engine = 0 == strcmp(argv[i], "nr")    ? Engine::NODE_REPLICATED
+                             : 0 == strcmp(argv[i], "shm") ? Engine::SHARED_MEMORY
+                                                           : Engine::SPLIT_ORDERED;
+        }
+        else if (0 == strcmp(argv[i], "--shm-name") && i + 1 < argc)
+            options.shm_name = argv[++i];
+        else if (0 == strcmp(argv[i], "--delegate") && i + 1 < argc)
+            options.delegation_owners_per_node = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "--partial"))
+            options.partial_replication = true;
+        else if (0 == strcmp(argv[i], "--slow-op-ns") && i + 1 < argc)
+            options.slow_op_threshold = nanoseconds{atol(argv[++i])};
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            exit(-1);
+        }
+    }
     if (MAX_THREAD < num_thread)
     {
         fprintf(stderr, "the upper limit of a number of thread is %d\n", MAX_THREAD);
         exit(-1);
     }
 
-    const unsigned NUMA_NODE_NUM = numa_num_configured_nodes();
-    const unsigned CPU_NUM = numa_num_configured_cpus()/2;
-    const unsigned CORE_PER_NODE = CPU_NUM/NUMA_NODE_NUM;
+    if (virtual_nodes != 0)
+        simulate_numa_nodes(virtual_nodes, remote_delay);
+    const auto &topology = numa_topology();
+    const unsigned NUMA_NODE_NUM = topology.node_num;
+    const unsigned CORE_PER_NODE = topology.core_per_node;
     auto required_node_num = max(1u, min((unsigned)ceil((double)num_thread/(double)CORE_PER_NODE), NUMA_NODE_NUM));
     auto real_num_thread = num_thread;
-    if (num_thread >= CORE_PER_NODE) {
+    // 가상 node 모드에서는 helper thread 몫의 core를 남겨둘 필요가 없다.
+    if (topology.simulated) {
+        required_node_num = NUMA_NODE_NUM;
+    } else if (num_thread >= CORE_PER_NODE && num_thread > 1 + required_node_num) {
         real_num_thread -= 1 + required_node_num;
     }
 
-    SO_Hashtable my_table{required_node_num};
+    // 이름을 주지 않았으면 이 process만 쓰는 region을 만들고 끝날 때 지운다.
+    bool own_region = false;
+    if (options.engine == Engine::SHARED_MEMORY && options.shm_name.empty())
+    {
+        options.shm_name = "/so_bench_" + to_string(getpid());
+        own_region = true;
+    }
+    SO_Hashtable my_table{required_node_num, options};
+    // 실행 중에 SIGUSR2를 보내면 그때까지의 느린 operation을 볼 수 있다.
+    if (options.slow_op_threshold.count() != 0)
+        dump_slow_ops_on_signal(SIGUSR2);
+    if (own_region)
+        ShmHashtable::unlink(options.shm_name);
+    HelperPerf helper_perf{perf, my_table};
+    vector<PerfSample> worker_samples(real_num_thread);
+    auto sample_of = [&](int i) { return perf ? &worker_samples[i] : nullptr; };
 
     vector<thread> worker;
+    if (prefill_num != 0)
+    {
+        helper_perf.start();
+        for (int i = 0; i < real_num_thread; ++i)
+            worker.push_back(thread{prefill, ref(my_table), real_num_thread, i, required_node_num, prefill_num, sample_of(i)});
+        for (auto &th : worker)
+            th.join();
+        worker.clear();
+        auto helper_samples = helper_perf.stop();
+        if (perf)
+            report_perf("prefill", prefill_num, required_node_num, worker_samples, helper_samples);
+    }
+
+    unique_ptr<TraceRecorder> recorder;
+    unique_ptr<TraceReader> trace;
+    try
+    {
+        if (replay_path != nullptr)
+            trace = make_unique<TraceReader>(replay_path);
+    }
+    catch (const exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        exit(-1);
+    }
+    if (record_path != nullptr)
+    {
+        recorder = make_unique<TraceRecorder>();
+        my_table.set_trace_recorder(recorder.get());
+    }
+
+    helper_perf.start();
     auto start_t = high_resolution_clock::now();
+    auto replay_start_t = steady_clock::now();
     for (int i = 0; i < real_num_thread; ++i)
-        worker.push_back(thread{benchmark, ref(my_table), real_num_thread, i});
+    {
+        if (trace)
+            worker.push_back(thread{replay, ref(my_table), cref(*trace), real_num_thread, i, required_node_num, paced, replay_start_t, sample_of(i)});
+        else
+            worker.push_back(thread{benchmark, ref(my_table), real_num_thread, i, required_node_num, sample_of(i)});
+    }
     for (auto &th : worker)
         th.join();
     auto du = high_resolution_clock::now() - start_t;
+    auto helper_samples = helper_perf.stop();
 
     cout << num_thread << " Threads,  Time = ";
     cout << duration_cast<milliseconds>(du).count() << " ms" << endl;
+    if (perf)
+    {
+        uint64_t op_num = trace ? trace->size() : (NUM_TEST / real_num_thread) * real_num_thread;
+        report_perf("steady", op_num, required_node_num, worker_samples, helper_samples);
+    }
+
+    if (recorder)
+    {
+        my_table.set_trace_recorder(nullptr);
+        recorder->write(record_path);
+    }
+    if (options.slow_op_threshold.count() != 0)
+        dump_slow_ops(stderr);
 }
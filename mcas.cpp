@@ -0,0 +1,127 @@
+#include <algorithm>
+#include "mcas.h"
+#include "stress_hooks.h"
+
+using namespace std;
+
+namespace so
+{
+
+enum McasStatus
+{
+    MCAS_UNDECIDED,
+    MCAS_FAILED,
+    MCAS_SUCCEEDED,
+};
+
+static bool is_mcas(uintptr_t value) { return (value & MCAS_TAG) != 0; }
+static bool is_rdcss(uintptr_t value) { return (value & RDCSS_TAG) != 0; }
+
+static McasDescriptor *as_mcas(uintptr_t value)
+{
+    return reinterpret_cast<McasDescriptor *>(value & ~DESCRIPTOR_BITS);
+}
+
+static McasEntry *as_rdcss(uintptr_t value)
+{
+    return reinterpret_cast<McasEntry *>(value & ~DESCRIPTOR_BITS);
+}
+
+// MCAS가 아직 UNDECIDED이면 RDCSS descriptor를 MCAS descriptor로 바꾸고, 이미 결정났으면 원래 값으로 되돌린다.
+static void rdcss_complete(McasEntry *entry)
+{
+    auto desc = entry->owner;
+    uintptr_t expected = reinterpret_cast<uintptr_t>(entry) | RDCSS_TAG;
+    uintptr_t value = desc->status.load(memory_order_acquire) == MCAS_UNDECIDED
+                          ? reinterpret_cast<uintptr_t>(desc) | MCAS_TAG
+                          : entry->old_value;
+    entry->addr->compare_exchange_strong(expected, value);
+}
+
+// word가 old_value일 때 MCAS descriptor를 넣는다. 설치를 시도하기 전 word의 값을 반환
+static uintptr_t rdcss(McasEntry *entry)
+{
+    const uintptr_t tagged = reinterpret_cast<uintptr_t>(entry) | RDCSS_TAG;
+    while (true)
+    {
+        uintptr_t current = entry->old_value;
+        SO_PERTURB();
+        if (entry->addr->compare_exchange_strong(current, tagged))
+        {
+            rdcss_complete(entry);
+            return entry->old_value;
+        }
+        if (false == is_rdcss(current))
+            return current;
+        rdcss_complete(as_rdcss(current));
+    }
+}
+
+static uintptr_t rdcss_read(atomic_uintptr_t *addr)
+{
+    while (true)
+    {
+        auto value = addr->load(memory_order_acquire);
+        if (false == is_rdcss(value))
+            return value;
+        rdcss_complete(as_rdcss(value));
+    }
+}
+
+// entry를 주소 순서로 잠그므로 서로 돕는 MCAS 사이에 순환이 생기지 않는다.
+static bool mcas_help(McasDescriptor *desc)
+{
+    const uintptr_t tagged = reinterpret_cast<uintptr_t>(desc) | MCAS_TAG;
+    if (desc->status.load(memory_order_acquire) == MCAS_UNDECIDED)
+    {
+        int status = MCAS_SUCCEEDED;
+        for (unsigned i = 0; i < desc->n && status == MCAS_SUCCEEDED; ++i)
+        {
+            auto &entry = desc->entries[i];
+            while (true)
+            {
+                auto value = rdcss(&entry);
+                if (is_mcas(value) && value != tagged)
+                {
+                    mcas_help(as_mcas(value));
+                    continue;
+                }
+                if (false == is_mcas(value) && value != entry.old_value)
+                    status = MCAS_FAILED;
+                break;
+            }
+        }
+        int expected = MCAS_UNDECIDED;
+        SO_PERTURB();
+        desc->status.compare_exchange_strong(expected, status);
+    }
+
+    const bool succeeded = desc->status.load(memory_order_acquire) == MCAS_SUCCEEDED;
+    for (unsigned i = 0; i < desc->n; ++i)
+    {
+        auto &entry = desc->entries[i];
+        uintptr_t expected = tagged;
+        entry.addr->compare_exchange_strong(expected, succeeded ? entry.new_value : entry.old_value);
+    }
+    return succeeded;
+}
+
+bool mcas(McasDescriptor *desc)
+{
+    sort(desc->entries, desc->entries + desc->n, [](auto &a, auto &b) { return a.addr < b.addr; });
+    desc->status.store(MCAS_UNDECIDED, memory_order_release);
+    return mcas_help(desc);
+}
+
+uintptr_t mcas_read(atomic_uintptr_t *addr)
+{
+    while (true)
+    {
+        auto value = rdcss_read(addr);
+        if (false == is_mcas(value))
+            return value;
+        mcas_help(as_mcas(value));
+    }
+}
+
+} // namespace so
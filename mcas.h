@@ -0,0 +1,49 @@
+#ifndef F27B4E90_8C1D_4E35_B6A2_3D9F05C1E7B8
+#define F27B4E90_8C1D_4E35_B6A2_3D9F05C1E7B8
+
+#include <atomic>
+#include <cstdint>
+
+namespace so
+{
+
+// Harris, Fraser, Pratt의 multi-word CAS (RDCSS + CASN).
+// 진행 중인 MCAS는 word에 descriptor pointer를 tag와 함께 넣어두고, 그 word를 읽는 thread가 대신 끝내준다.
+// bit 0은 LFNODE의 mark bit이므로 descriptor는 bit 1, 2를 tag로 쓴다.
+constexpr uintptr_t MCAS_TAG = 0x2;
+constexpr uintptr_t RDCSS_TAG = 0x4;
+constexpr uintptr_t DESCRIPTOR_BITS = MCAS_TAG | RDCSS_TAG;
+constexpr unsigned MCAS_MAX_WORDS = 4;
+
+struct McasDescriptor;
+
+// RDCSS descriptor를 따로 할당하지 않고 entry의 주소를 RDCSS descriptor로 쓴다.
+struct McasEntry
+{
+    std::atomic_uintptr_t *addr;
+    uintptr_t old_value;
+    uintptr_t new_value;
+    McasDescriptor *owner;
+};
+
+struct McasDescriptor
+{
+    std::atomic_int status{0};
+    unsigned n = 0;
+    McasEntry entries[MCAS_MAX_WORDS];
+
+    void add(std::atomic_uintptr_t *addr, uintptr_t old_value, uintptr_t new_value)
+    {
+        entries[n++] = McasEntry{addr, old_value, new_value, this};
+    }
+};
+
+// 모든 entry의 word가 old_value이면 한번에 new_value로 바꾼다. descriptor는 다른 thread가 아직 읽고 있을 수 있으므로
+// 호출한 쪽에서 epoch 기반으로 회수해야 한다.
+bool mcas(McasDescriptor *desc);
+// word에 descriptor가 있으면 그 MCAS를 끝낸 뒤의 값을 반환
+uintptr_t mcas_read(std::atomic_uintptr_t *addr);
+
+} // namespace so
+
+#endif /* F27B4E90_8C1D_4E35_B6A2_3D9F05C1E7B8 */
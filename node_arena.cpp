@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "node_arena.h"
+#include "topology.h"
+
+using namespace std;
+
+namespace so
+{
+
+constexpr uint32_t LARGE_CLASS = ~0u;
+constexpr unsigned THREAD_CACHE_MAX = 256;
+constexpr unsigned REFILL_NUM = 32;
+
+// 모든 block 앞에 붙는 header. block이 어느 node, 어느 class인지 기록한다.
+struct alignas(16) BlockHeader
+{
+    uint32_t size_class;
+    uint32_t node;
+    size_t large_size;
+};
+
+struct NodeArena
+{
+    mutex lock;
+    vector<void *> free_lists[ARENA_CLASS_NUM];
+    // 다른 node의 thread가 이 node에 할당할 때 쓰는 bump chunk. lock으로 보호
+    char *bump = nullptr;
+    char *bump_end = nullptr;
+};
+
+static NodeArena node_arenas[ARENA_MAX_NODE];
+
+static size_t class_size(unsigned size_class)
+{
+    return ARENA_MIN_BLOCK << size_class;
+}
+
+static unsigned size_class_of(size_t block_size)
+{
+    unsigned size_class = 0;
+    while (size_class < ARENA_CLASS_NUM && class_size(size_class) < block_size)
+    {
+        ++size_class;
+    }
+    return size_class;
+}
+
+// 다 쓰지 못한 bump chunk의 나머지를 큰 class부터 잘라 free list에 넣는다. arena.lock을 잡고 불러야 한다.
+// block은 모두 ARENA_MIN_BLOCK의 배수이므로 나머지도 남김없이 잘린다.
+static void release_bump(NodeArena &arena, char *bump, char *bump_end)
+{
+    if (bump == nullptr)
+        return;
+    for (unsigned c = ARENA_CLASS_NUM; c-- > 0;)
+    {
+        while (bump + class_size(c) <= bump_end)
+        {
+            arena.free_lists[c].push_back(bump);
+            bump += class_size(c);
+        }
+    }
+}
+
+// thread가 다 쓰지 못한 bump chunk를 node에 돌려준다. 남은 부분이 더 큰 쪽을 node의 bump chunk로 두고
+// 작은 쪽은 free list로 잘라 넣는다. arena.lock을 잡고 불러야 한다.
+static void give_back_bump(NodeArena &arena, char *bump, char *bump_end)
+{
+    if (bump_end - bump > arena.bump_end - arena.bump)
+    {
+        swap(bump, arena.bump);
+        swap(bump_end, arena.bump_end);
+    }
+    release_bump(arena, bump, bump_end);
+}
+
+static char *alloc_chunk(unsigned node)
+{
+    auto chunk = static_cast<char *>(numa_alloc_onnode(ARENA_CHUNK_SIZE, real_node(node)));
+    if (chunk == nullptr)
+        throw bad_alloc();
+    return chunk;
+}
+
+// thread마다 가진 bump chunk와 class별 cache. thread의 node가 바뀌거나 thread가 끝나면 node로 돌려준다.
+struct ThreadArena
+{
+    int node = -1;
+    char *bump = nullptr;
+    char *bump_end = nullptr;
+    vector<void *> cache[ARENA_CLASS_NUM];
+
+    // cache와 bump chunk의 남은 부분을 node에 돌려준다. node를 옮겨 다니는 thread도 chunk를 버리지 않는다.
+    void flush()
+    {
+        if (node < 0)
+            return;
+        auto &arena = node_arenas[node];
+        lock_guard<mutex> guard{arena.lock};
+        for (unsigned c = 0; c < ARENA_CLASS_NUM; ++c)
+        {
+            arena.free_lists[c].insert(arena.free_lists[c].end(), cache[c].begin(), cache[c].end());
+            cache[c].clear();
+        }
+        give_back_bump(arena, bump, bump_end);
+        bump = bump_end = nullptr;
+    }
+
+    void switch_node(int new_node)
+    {
+        flush();
+        node = new_node;
+    }
+
+    ~ThreadArena() { flush(); }
+};
+
+static thread_local ThreadArena t_arena;
+
+static void *alloc_large(unsigned node, size_t block_size)
+{
+    auto header = reinterpret_cast<BlockHeader *>(numa_alloc_onnode(block_size, real_node(node)));
+    if (header == nullptr)
+        throw bad_alloc();
+    header->size_class = LARGE_CLASS;
+    header->node = node;
+    header->large_size = block_size;
+    return header + 1;
+}
+
+void *arena_alloc(size_t size)
+{
+    const unsigned node = current_node() % ARENA_MAX_NODE;
+    const size_t block_size = size + sizeof(BlockHeader);
+    const unsigned size_class = size_class_of(block_size);
+    BlockHeader *header;
+
+    if (size_class == ARENA_CLASS_NUM)
+        return alloc_large(node, block_size);
+
+    if (t_arena.node != (int)node)
+        t_arena.switch_node(node);
+    auto &cache = t_arena.cache[size_class];
+    if (cache.empty())
+    {
+        auto &arena = node_arenas[node];
+        lock_guard<mutex> guard{arena.lock};
+        auto &free_list = arena.free_lists[size_class];
+        auto n = min<size_t>(REFILL_NUM, free_list.size());
+        cache.insert(cache.end(), free_list.end() - n, free_list.end());
+        free_list.resize(free_list.size() - n);
+    }
+    if (!cache.empty())
+    {
+        header = reinterpret_cast<BlockHeader *>(cache.back());
+        cache.pop_back();
+    }
+    else
+    {
+        const size_t bytes = class_size(size_class);
+        if (t_arena.bump + bytes > t_arena.bump_end)
+        {
+            // 다른 thread나 이전에 이 node를 떠난 thread가 돌려준 chunk가 있으면 그것부터 쓴다.
+            auto &arena = node_arenas[node];
+            {
+                lock_guard<mutex> guard{arena.lock};
+                if (arena.bump + bytes <= arena.bump_end)
+                {
+                    swap(t_arena.bump, arena.bump);
+                    swap(t_arena.bump_end, arena.bump_end);
+                }
+                release_bump(arena, arena.bump, arena.bump_end);
+                arena.bump = arena.bump_end = nullptr;
+            }
+            if (t_arena.bump + bytes > t_arena.bump_end)
+            {
+                auto chunk = alloc_chunk(node);
+                lock_guard<mutex> guard{arena.lock};
+                release_bump(arena, t_arena.bump, t_arena.bump_end);
+                t_arena.bump = chunk;
+                t_arena.bump_end = chunk + ARENA_CHUNK_SIZE;
+            }
+        }
+        header = reinterpret_cast<BlockHeader *>(t_arena.bump);
+        t_arena.bump += bytes;
+    }
+    header->size_class = size_class;
+    header->node = node;
+    return header + 1;
+}
+
+// thread cache는 자기 node용이므로 다른 node에 할당할 때는 그 node의 free list와 bump chunk를 lock을 잡고 쓴다.
+void *arena_alloc_on(unsigned node, size_t size)
+{
+    node %= ARENA_MAX_NODE;
+    if (node == current_node() % ARENA_MAX_NODE)
+        return arena_alloc(size);
+
+    const size_t block_size = size + sizeof(BlockHeader);
+    const unsigned size_class = size_class_of(block_size);
+    if (size_class == ARENA_CLASS_NUM)
+        return alloc_large(node, block_size);
+
+    BlockHeader *header;
+    auto &arena = node_arenas[node];
+    {
+        lock_guard<mutex> guard{arena.lock};
+        auto &free_list = arena.free_lists[size_class];
+        if (false == free_list.empty())
+        {
+            header = reinterpret_cast<BlockHeader *>(free_list.back());
+            free_list.pop_back();
+        }
+        else
+        {
+            const size_t bytes = class_size(size_class);
+            if (arena.bump + bytes > arena.bump_end)
+            {
+                auto chunk = alloc_chunk(node);
+                release_bump(arena, arena.bump, arena.bump_end);
+                arena.bump = chunk;
+                arena.bump_end = chunk + ARENA_CHUNK_SIZE;
+            }
+            header = reinterpret_cast<BlockHeader *>(arena.bump);
+            arena.bump += bytes;
+        }
+    }
+    header->size_class = size_class;
+    header->node = node;
+    return header + 1;
+}
+
+void arena_free(void *ptr)
+{
+    auto header = reinterpret_cast<BlockHeader *>(ptr) - 1;
+    if (header->size_class == LARGE_CLASS)
+    {
+        numa_free(header, header->large_size);
+        return;
+    }
+    if ((int)header->node == t_arena.node && t_arena.cache[header->size_class].size() < THREAD_CACHE_MAX)
+    {
+        t_arena.cache[header->size_class].push_back(header);
+        return;
+    }
+    auto &arena = node_arenas[header->node];
+    lock_guard<mutex> guard{arena.lock};
+    arena.free_lists[header->size_class].push_back(header);
+}
+
+} // namespace so
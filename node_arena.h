@@ -0,0 +1,51 @@
+#ifndef B83F1D6C_2E9A_4A57_9C04_D5E1A7B3F862
+#define B83F1D6C_2E9A_4A57_9C04_D5E1A7B3F862
+
+#include <cstddef>
+
+namespace so
+{
+
+// NUMA node마다 따로 두는 size-class allocator. 현재 thread의 node에서 1MB chunk를 받아 잘라 쓴다.
+// 해제된 block은 원래 node의 free list로 돌아가므로 다른 node에서 해제해도 메모리가 섞이지 않는다.
+constexpr size_t ARENA_CHUNK_SIZE = 1 << 20;
+constexpr size_t ARENA_MIN_BLOCK = 32;
+constexpr unsigned ARENA_CLASS_NUM = 12; // 32B ~ 64KB, 더 크면 node에 바로 할당
+constexpr unsigned ARENA_MAX_NODE = 64;
+
+void *arena_alloc(size_t size);
+// node번째 (가상) node의 메모리에 할당. 현재 thread의 node가 아니어도 된다.
+void *arena_alloc_on(unsigned node, size_t size);
+void arena_free(void *ptr);
+
+// STL container의 node들을 정해진 NUMA node의 arena에서 할당하는 allocator
+template <typename T>
+struct NodeAllocator
+{
+    using value_type = T;
+    unsigned node;
+
+    explicit NodeAllocator(unsigned node) : node{node} {}
+    template <typename U>
+    NodeAllocator(const NodeAllocator<U> &other) : node{other.node}
+    {
+    }
+
+    T *allocate(size_t n) { return static_cast<T *>(arena_alloc_on(node, n * sizeof(T))); }
+    void deallocate(T *ptr, size_t) { arena_free(ptr); }
+
+    template <typename U>
+    bool operator==(const NodeAllocator<U> &other) const
+    {
+        return node == other.node;
+    }
+    template <typename U>
+    bool operator!=(const NodeAllocator<U> &other) const
+    {
+        return node != other.node;
+    }
+};
+
+} // namespace so
+
+#endif /* B83F1D6C_2E9A_4A57_9C04_D5E1A7B3F862 */
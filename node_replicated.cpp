@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include "node_replicated.h"
+#include "topology.h"
+
+using namespace std;
+
+namespace so
+{
+
+enum SlotState
+{
+    SLOT_EMPTY,
+    SLOT_PENDING,
+    SLOT_DONE,
+};
+
+// reader의 slot 표시와 writer 표시는 서로의 store를 반드시 보도록 seq_cst로 쓰고 읽는다.
+void NR_ReaderLock::lock_shared()
+{
+    auto &active = readers[thread_slot()].active;
+    while (true)
+    {
+        active.store(true, memory_order_seq_cst);
+        if (false == writer.load(memory_order_seq_cst))
+            return;
+        // writer가 먼저 기다리고 있으면 물러나서 writer가 끝나기를 기다린다.
+        active.store(false, memory_order_release);
+        while (writer.load(memory_order_acquire))
+        {
+            this_thread::yield();
+        }
+    }
+}
+
+void NR_ReaderLock::unlock_shared()
+{
+    readers[thread_slot()].active.store(false, memory_order_release);
+}
+
+void NR_ReaderLock::lock()
+{
+    bool expected = false;
+    while (false == writer.compare_exchange_weak(expected, true, memory_order_seq_cst))
+    {
+        expected = false;
+        this_thread::yield();
+    }
+    for (auto &reader : readers)
+    {
+        while (reader.active.load(memory_order_seq_cst))
+        {
+            this_thread::yield();
+        }
+    }
+}
+
+void NR_ReaderLock::unlock()
+{
+    writer.store(false, memory_order_release);
+}
+
+NR_Hashtable::NR_Hashtable(unsigned node_num)
+{
+    // log는 모든 node가 쓰므로 node들에 골고루 펼쳐 둔다.
+    void *raw_log = numa_alloc_interleaved(sizeof(NR_LogEntry) * NR_LOG_SIZE);
+    log = reinterpret_cast<NR_LogEntry *>(raw_log);
+    for (unsigned long long i = 0; i < NR_LOG_SIZE; ++i)
+    {
+        new (&log[i]) NR_LogEntry;
+    }
+    for (unsigned i = 0; i < node_num; ++i)
+    {
+        replicas.push_back(NUMA_alloc<NR_Replica>(i, i));
+    }
+}
+
+NR_Hashtable::~NR_Hashtable()
+{
+    for (auto replica : replicas)
+    {
+        NUMA_dealloc(replica);
+    }
+    numa_free(log, sizeof(NR_LogEntry) * NR_LOG_SIZE);
+}
+
+NR_Replica &NR_Hashtable::local_replica()
+{
+    return *replicas[current_node() % replicas.size()];
+}
+
+// [replica.local_tail, end) 구간의 log를 replica에 적용. combiner lock을 가진 thread만 호출한다.
+// [batch_start, batch_start + batch_num) 구간은 호출한 combiner가 넣은 operation이므로 결과를 slot에 돌려준다.
+void NR_Hashtable::apply_until(NR_Replica &replica, unsigned long long end, unsigned long long batch_start,
+                               const unsigned *batch, unsigned batch_num)
+{
+    auto idx = replica.local_tail.load(memory_order_relaxed);
+    if (idx >= end)
+        return;
+    {
+        unique_lock<NR_ReaderLock> guard{replica.lock};
+        for (; idx < end; ++idx)
+        {
+            auto &entry = log[idx % NR_LOG_SIZE];
+            // 다른 combiner가 예약만 하고 아직 채우지 않았을 수 있다.
+            while (entry.seq.load(memory_order_acquire) != idx + 1)
+            {
+                this_thread::yield();
+            }
+            bool result;
+            if (entry.op == NR_OpType::INSERT)
+                result = replica.table.emplace(entry.key, entry.value).second;
+            else
+                result = replica.table.erase(entry.key) != 0;
+            if (batch != nullptr && idx >= batch_start && idx < batch_start + batch_num)
+                replica.slots[batch[idx - batch_start]].result = result;
+        }
+    }
+    replica.local_tail.store(end, memory_order_release);
+
+    auto completed = completed_tail.load(memory_order_relaxed);
+    while (completed < end && !completed_tail.compare_exchange_weak(completed, end))
+    {
+    }
+}
+
+// log에서 n개의 entry를 예약. log가 가득 차면 자기 replica를 최신으로 만들고 뒤처진 replica를 대신 적용해준다.
+unsigned long long NR_Hashtable::reserve(NR_Replica &replica, unsigned n)
+{
+    while (true)
+    {
+        auto tail = log_tail.load(memory_order_acquire);
+        auto min_tail = tail;
+        for (auto r : replicas)
+        {
+            min_tail = min(min_tail, r->local_tail.load(memory_order_acquire));
+        }
+        if (tail + n - min_tail <= NR_LOG_SIZE)
+        {
+            if (log_tail.compare_exchange_weak(tail, tail + n))
+                return tail;
+            continue;
+        }
+
+        apply_until(replica, tail);
+        for (auto r : replicas)
+        {
+            if (r == &replica || r->local_tail.load(memory_order_acquire) >= tail)
+                continue;
+            if (!r->combiner.test_and_set(memory_order_acquire))
+            {
+                apply_until(*r, tail);
+                r->combiner.clear(memory_order_release);
+            }
+        }
+        this_thread::yield();
+    }
+}
+
+void NR_Hashtable::combine(NR_Replica &replica)
+{
+    unsigned batch[MAX_THREAD];
+    unsigned n = 0;
+    for (unsigned i = 0; i < MAX_THREAD; ++i)
+    {
+        if (replica.slots[i].state.load(memory_order_acquire) == SLOT_PENDING)
+            batch[n++] = i;
+    }
+    if (n == 0)
+        return;
+
+    auto start = reserve(replica, n);
+    for (unsigned k = 0; k < n; ++k)
+    {
+        auto &slot = replica.slots[batch[k]];
+        auto &entry = log[(start + k) % NR_LOG_SIZE];
+        entry.op = slot.op;
+        entry.key = slot.key;
+        entry.value = slot.value;
+        entry.seq.store(start + k + 1, memory_order_release);
+    }
+    apply_until(replica, start + n, start, batch, n);
+    for (unsigned k = 0; k < n; ++k)
+    {
+        replica.slots[batch[k]].state.store(SLOT_DONE, memory_order_release);
+    }
+}
+
+bool NR_Hashtable::execute(NR_OpType op, unsigned long key, unsigned long value)
+{
+    auto &replica = local_replica();
+    auto &slot = replica.slots[thread_slot()];
+    slot.op = op;
+    slot.key = key;
+    slot.value = value;
+    slot.state.store(SLOT_PENDING, memory_order_release);
+    while (slot.state.load(memory_order_acquire) != SLOT_DONE)
+    {
+        if (!replica.combiner.test_and_set(memory_order_acquire))
+        {
+            combine(replica);
+            replica.combiner.clear(memory_order_release);
+        }
+        else
+        {
+            this_thread::yield();
+        }
+    }
+    slot.state.store(SLOT_EMPTY, memory_order_relaxed);
+    return slot.result;
+}
+
+// read 시작 시점까지 완료된 update가 replica에 반영되도록 한다.
+void NR_Hashtable::sync(NR_Replica &replica, unsigned long long tail)
+{
+    while (replica.local_tail.load(memory_order_acquire) < tail)
+    {
+        if (!replica.combiner.test_and_set(memory_order_acquire))
+        {
+            apply_until(replica, tail);
+            replica.combiner.clear(memory_order_release);
+        }
+        else
+        {
+            this_thread::yield();
+        }
+    }
+}
+
+bool NR_Hashtable::insert(unsigned long key, unsigned long value)
+{
+    return execute(NR_OpType::INSERT, key, value);
+}
+
+bool NR_Hashtable::remove(unsigned long key)
+{
+    return execute(NR_OpType::REMOVE, key, 0);
+}
+
+optional<unsigned long> NR_Hashtable::find(unsigned long key)
+{
+    auto &replica = local_replica();
+    sync(replica, completed_tail.load(memory_order_acquire));
+
+    shared_lock<NR_ReaderLock> guard{replica.lock};
+    auto it = replica.table.find(key);
+    if (it == replica.table.end())
+        return nullopt;
+    return it->second;
+}
+
+// 지울 key는 local replica에서 고르고, 삭제는 일반 remove처럼 log를 거친다.
+size_t NR_Hashtable::erase_if(const function<bool(unsigned long, unsigned long)> &pred)
+{
+    auto &replica = local_replica();
+    sync(replica, completed_tail.load(memory_order_acquire));
+
+    vector<unsigned long> keys;
+    {
+        shared_lock<NR_ReaderLock> guard{replica.lock};
+        for (auto &[key, value] : replica.table)
+        {
+            if (pred(key, value))
+                keys.push_back(key);
+        }
+    }
+
+    size_t erased = 0;
+    for (auto key : keys)
+    {
+        erased += remove(key) ? 1 : 0;
+    }
+    return erased;
+}
+
+size_t NR_Hashtable::check_replicas()
+{
+    auto tail = log_tail.load(memory_order_acquire);
+    for (auto r : replicas)
+    {
+        sync(*r, tail);
+    }
+
+    size_t mismatch = 0;
+    auto &first = *replicas[0];
+    shared_lock<NR_ReaderLock> first_guard{first.lock};
+    for (unsigned i = 1; i < replicas.size(); ++i)
+    {
+        auto &other = *replicas[i];
+        shared_lock<NR_ReaderLock> guard{other.lock};
+        for (auto &[key, value] : first.table)
+        {
+            auto it = other.table.find(key);
+            if (it == other.table.end() || it->second != value)
+                ++mismatch;
+        }
+        for (auto &[key, value] : other.table)
+        {
+            if (first.table.count(key) == 0)
+                ++mismatch;
+        }
+    }
+    return mismatch;
+}
+
+} // namespace so
@@ -0,0 +1,108 @@
+#ifndef A9C35E71_4B28_4D0F_8E6A_1F7D2B9C5E80
+#define A9C35E71_4B28_4D0F_8E6A_1F7D2B9C5E80
+
+#include <atomic>
+#include <functional>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include "lf_set.h"
+#include "node_arena.h"
+
+namespace so
+{
+
+// Node Replication (Calciu et al., ASPLOS'17) 방식의 engine.
+// node마다 table 전체의 sequential replica를 두고, update는 모든 node가 공유하는 log에 append 한 뒤
+// 각 node의 combiner가 자기 replica에 순서대로 적용한다. read는 자기 node의 replica만 읽는다.
+constexpr unsigned long long NR_LOG_SIZE = 1 << 20;
+
+enum class NR_OpType : uint8_t
+{
+    INSERT,
+    REMOVE,
+};
+
+struct NR_LogEntry
+{
+    std::atomic_ullong seq{0}; // 채워지면 log index + 1
+    NR_OpType op;
+    unsigned long key;
+    unsigned long value;
+};
+
+// flat combining slot. 한 thread가 자기 node의 replica에 operation을 맡기는 곳
+struct alignas(64) NR_Slot
+{
+    std::atomic_int state{0};
+    NR_OpType op;
+    unsigned long key;
+    unsigned long value;
+    bool result;
+};
+
+// replica를 읽는 thread들이 한 cache line을 두고 다투지 않도록 thread slot마다 reader 표시를 따로 두는 lock.
+// reader는 자기 slot에만 쓰고, writer(combiner)는 writer 표시를 세운 뒤 모든 reader slot이 빌 때까지 기다린다.
+// std::shared_lock / std::unique_lock과 함께 쓸 수 있다.
+class NR_ReaderLock
+{
+public:
+    void lock_shared();
+    void unlock_shared();
+    void lock();
+    void unlock();
+
+private:
+    struct alignas(64) ReaderSlot
+    {
+        std::atomic_bool active{false};
+    };
+
+    alignas(64) std::atomic_bool writer{false};
+    ReaderSlot readers[MAX_THREAD];
+};
+
+using NR_Map = std::unordered_map<unsigned long, unsigned long, std::hash<unsigned long>, std::equal_to<unsigned long>,
+                                  NodeAllocator<std::pair<const unsigned long, unsigned long>>>;
+
+struct NR_Replica
+{
+    explicit NR_Replica(unsigned numa_id) : table{0, std::hash<unsigned long>{}, std::equal_to<unsigned long>{}, NR_Map::allocator_type{numa_id}} {}
+
+    NR_Map table; // item들도 replica의 node 메모리에 둔다.
+    NR_ReaderLock lock;
+    std::atomic_flag combiner = ATOMIC_FLAG_INIT;
+    std::atomic_ullong local_tail{0}; // 이 replica에 적용된 log 끝
+    NR_Slot slots[MAX_THREAD];
+};
+
+class NR_Hashtable
+{
+public:
+    NR_Hashtable(unsigned node_num);
+    ~NR_Hashtable();
+    bool insert(unsigned long key, unsigned long value);
+    bool remove(unsigned long key);
+    std::optional<unsigned long> find(unsigned long key);
+    size_t erase_if(const std::function<bool(unsigned long, unsigned long)> &pred);
+    // 모든 replica를 log 끝까지 적용한 뒤 0번 replica와 내용이 다른 item 수 (테스트용)
+    size_t check_replicas();
+
+private:
+    std::vector<NR_Replica *> replicas;
+    NR_LogEntry *log;
+    std::atomic_ullong log_tail{0};       // 예약된 log 끝
+    std::atomic_ullong completed_tail{0}; // 어떤 replica에든 적용이 끝난 log 끝
+
+    NR_Replica &local_replica();
+    bool execute(NR_OpType op, unsigned long key, unsigned long value);
+    void combine(NR_Replica &replica);
+    unsigned long long reserve(NR_Replica &replica, unsigned n);
+    void apply_until(NR_Replica &replica, unsigned long long end, unsigned long long batch_start = 0,
+                     const unsigned *batch = nullptr, unsigned batch_num = 0);
+    void sync(NR_Replica &replica, unsigned long long tail);
+};
+
+} // namespace so
+
+#endif /* A9C35E71_4B28_4D0F_8E6A_1F7D2B9C5E80 */
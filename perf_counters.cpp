@@ -0,0 +1,155 @@
+#include <cstdio>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "perf_counters.h"
+
+using namespace std;
+
+namespace so
+{
+
+static const char *event_names[PERF_EVENT_NUM] = {
+    "cycles", "instructions", "llc-misses", "dtlb-misses", "local-dram", "remote-dram",
+};
+
+static constexpr uint64_t cache_config(uint64_t cache, uint64_t op, uint64_t result)
+{
+    return cache | (op << 8) | (result << 16);
+}
+
+static void fill_attr(unsigned event, perf_event_attr &attr)
+{
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    switch (event)
+    {
+    case PERF_CYCLES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case PERF_INSTRUCTIONS:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case PERF_LLC_MISSES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    case PERF_DTLB_MISSES:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = cache_config(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS);
+        break;
+    case PERF_LOCAL_DRAM:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = cache_config(PERF_COUNT_HW_CACHE_NODE, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_ACCESS);
+        break;
+    case PERF_REMOTE_DRAM:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = cache_config(PERF_COUNT_HW_CACHE_NODE, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS);
+        break;
+    }
+}
+
+const char *perf_event_name(unsigned event)
+{
+    return event_names[event];
+}
+
+pid_t current_tid()
+{
+    return syscall(SYS_gettid);
+}
+
+PerfSample &PerfSample::operator+=(const PerfSample &other)
+{
+    for (unsigned i = 0; i < PERF_EVENT_NUM; ++i)
+    {
+        counts[i] += other.counts[i];
+        valid[i] = valid[i] || other.valid[i];
+    }
+    return *this;
+}
+
+string PerfSample::per_op(uint64_t op_num) const
+{
+    string line;
+    char buf[64];
+    for (unsigned i = 0; i < PERF_EVENT_NUM; ++i)
+    {
+        if (valid[i] && op_num != 0)
+            snprintf(buf, sizeof(buf), "%s%s/op %.2f", line.empty() ? "" : ", ", event_names[i], (double)counts[i] / op_num);
+        else
+            snprintf(buf, sizeof(buf), "%s%s/op n/a", line.empty() ? "" : ", ", event_names[i]);
+        line += buf;
+    }
+    return line;
+}
+
+PerfCounters::~PerfCounters()
+{
+    for (auto fd : fds)
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+bool PerfCounters::open(pid_t tid)
+{
+    bool opened = false;
+    for (unsigned i = 0; i < PERF_EVENT_NUM; ++i)
+    {
+        perf_event_attr attr;
+        fill_attr(i, attr);
+        fds[i] = syscall(SYS_perf_event_open, &attr, tid, -1, -1, 0);
+        opened = opened || fds[i] >= 0;
+    }
+    return opened;
+}
+
+void PerfCounters::enable()
+{
+    for (auto fd : fds)
+    {
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void PerfCounters::disable()
+{
+    for (auto fd : fds)
+    {
+        if (fd >= 0)
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+}
+
+PerfSample PerfCounters::read() const
+{
+    PerfSample sample;
+    for (unsigned i = 0; i < PERF_EVENT_NUM; ++i)
+    {
+        uint64_t values[3];
+        if (fds[i] < 0 || ::read(fds[i], values, sizeof(values)) != sizeof(values))
+            continue;
+        // values: count, time_enabled, time_running
+        if (values[2] != 0 && values[2] < values[1])
+            values[0] = (uint64_t)((double)values[0] * values[1] / values[2]);
+        sample.counts[i] = values[0];
+        sample.valid[i] = true;
+    }
+    return sample;
+}
+
+} // namespace so
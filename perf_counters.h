@@ -0,0 +1,59 @@
+#ifndef F2B7D4E8_1C6A_4E93_A5D0_7B3E9C1F6A24
+#define F2B7D4E8_1C6A_4E93_A5D0_7B3E9C1F6A24
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+
+namespace so
+{
+
+// perf_event_open으로 thread 하나의 hardware counter를 읽는다.
+// 지원하지 않는 event는 열리지 않은 채로 두고 결과에서 빠진다.
+enum PerfEvent
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_LOCAL_DRAM,  // NODE cache read access: 대부분의 CPU에서 local DRAM 접근
+    PERF_REMOTE_DRAM, // NODE cache read miss: 대부분의 CPU에서 remote DRAM 접근
+    PERF_EVENT_NUM,
+};
+
+const char *perf_event_name(unsigned event);
+
+struct PerfSample
+{
+    std::array<uint64_t, PERF_EVENT_NUM> counts{};
+    std::array<bool, PERF_EVENT_NUM> valid{};
+
+    PerfSample &operator+=(const PerfSample &other);
+    // 연산 하나당 값으로 정리한 한 줄. 열리지 않은 event는 n/a
+    std::string per_op(uint64_t op_num) const;
+};
+
+class PerfCounters
+{
+public:
+    PerfCounters() { fds.fill(-1); }
+    ~PerfCounters();
+    PerfCounters(const PerfCounters &) = delete;
+
+    // tid가 0이면 호출한 thread. 하나라도 열렸으면 true
+    bool open(pid_t tid);
+    void enable();
+    void disable();
+    // multiplexing으로 일부 시간만 측정된 event는 실행 시간 비율로 보정한다.
+    PerfSample read() const;
+
+private:
+    std::array<int, PERF_EVENT_NUM> fds;
+};
+
+pid_t current_tid();
+
+} // namespace so
+
+#endif /* F2B7D4E8_1C6A_4E93_A5D0_7B3E9C1F6A24 */
@@ -0,0 +1,623 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <numaif.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "shm_table.h"
+#include "split_ordered.h"
+#include "stress_hooks.h"
+#include "topology.h"
+
+using namespace std;
+
+namespace so
+{
+
+constexpr size_t SHM_PAGE_SIZE = 4096;
+constexpr ShmOffset SHM_MARK = 1;
+constexpr unsigned long SHM_KEY_MASK = 1ul << 63;
+constexpr size_t SHM_HEADER_BYTES = (sizeof(ShmHeader) + SHM_PAGE_SIZE - 1) / SHM_PAGE_SIZE * SHM_PAGE_SIZE;
+// segment 시작부터 bucket array까지의 거리. node arena는 그 뒤 max_buckets개의 bucket 다음부터다.
+constexpr size_t SHM_BUCKETS_AT = SHM_PAGE_SIZE;
+constexpr unsigned SHM_PID_BITS = 22; // pid_max의 상한이 2^22
+constexpr unsigned SHM_REFILL_NUM = 32;
+constexpr unsigned shm_epoch_freq = 100;
+constexpr unsigned shm_empty_freq = 1000;
+
+void ShmMutex::init()
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void ShmMutex::lock()
+{
+    int ret = pthread_mutex_lock(&mutex);
+    // 쥐고 있던 thread나 process가 죽었다. 보호하는 자료는 항상 일관되므로 그대로 넘겨받는다.
+    if (ret == EOWNERDEAD)
+        pthread_mutex_consistent(&mutex);
+    else if (ret != 0)
+        throw runtime_error("can't lock shared memory mutex");
+}
+
+// /proc/<pid>/stat의 22번째 field (boot 이후 process가 시작한 시각). 읽을 수 없으면 0
+static unsigned long long process_start_time(int pid)
+{
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *file = fopen(path, "r");
+    if (file == nullptr)
+        return 0;
+    char buf[1024];
+    auto len = fread(buf, 1, sizeof(buf) - 1, file);
+    fclose(file);
+    buf[len] = '\0';
+    // 2번째 field인 실행 파일 이름에 공백이나 ')'가 있을 수 있으므로 마지막 ')' 뒤부터 센다.
+    auto pos = strrchr(buf, ')');
+    unsigned long long start = 0;
+    if (pos == nullptr ||
+        sscanf(pos + 1, "%*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %llu", &start) != 1)
+        return 0;
+    return start;
+}
+
+// procs에 기록하는 process 식별자. pid만 보면 죽은 process의 pid를 새 process가 받았을 때 살아있다고 착각한다.
+static uint64_t proc_id(int pid)
+{
+    return (uint64_t)process_start_time(pid) << SHM_PID_BITS | (uint64_t)pid;
+}
+
+static bool process_alive(uint64_t id)
+{
+    int pid = (int)(id & ((1u << SHM_PID_BITS) - 1));
+    if (kill(pid, 0) != 0 && errno == ESRCH)
+        return false;
+    return proc_id(pid) == id;
+}
+
+ShmHashtable::ShmHashtable(const string &name, unsigned node_num, size_t node_bytes, unsigned long max_buckets)
+{
+    if (max_buckets < 2 || (max_buckets & (max_buckets - 1)) != 0)
+        throw invalid_argument("the bucket limit of a shared memory table must be a power of two");
+    if (node_num == 0 || node_bytes < SHM_BUCKETS_AT + max_buckets * sizeof(ShmOffset) + SHM_CHUNK_SIZE)
+        throw invalid_argument("invalid shared memory table size");
+
+    bool creator = true;
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST)
+    {
+        creator = false;
+        fd = shm_open(name.c_str(), O_RDWR, 0600);
+    }
+    if (fd < 0)
+        throw runtime_error("can't open shared memory " + name);
+
+    if (creator)
+    {
+        mapped_size = SHM_HEADER_BYTES + node_num * node_bytes;
+        if (ftruncate(fd, mapped_size) != 0)
+        {
+            close(fd);
+            shm_unlink(name.c_str());
+            throw runtime_error("can't resize shared memory " + name);
+        }
+    }
+    else
+    {
+        // 만든 process가 아직 ftruncate 하기 전일 수 있다.
+        struct stat st;
+        auto deadline = chrono::steady_clock::now() + 10s;
+        while (fstat(fd, &st) == 0 && (size_t)st.st_size < SHM_HEADER_BYTES && chrono::steady_clock::now() < deadline)
+        {
+            this_thread::sleep_for(1ms);
+        }
+        mapped_size = st.st_size;
+    }
+
+    void *mapped = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED || mapped_size < SHM_HEADER_BYTES)
+        throw runtime_error("can't map shared memory " + name);
+    base = reinterpret_cast<char *>(mapped);
+    header = reinterpret_cast<ShmHeader *>(base);
+
+    if (creator)
+    {
+        memcpy(header->magic, SHM_MAGIC, sizeof(header->magic));
+        header->node_num = node_num;
+        header->region_size = mapped_size;
+        header->node_bytes = node_bytes;
+        header->max_buckets = max_buckets;
+        header->bucket_num.store(2, memory_order_relaxed);
+        header->orphan_lock.init();
+        for (auto &proc_epochs : header->epochs)
+        {
+            for (auto &slot : proc_epochs)
+                slot.epoch.store(ULLONG_MAX, memory_order_relaxed);
+        }
+        for (unsigned i = 0; i < node_num; ++i)
+        {
+            auto arena_ptr = arena(i);
+            arena_ptr->lock.init();
+            arena_ptr->bump.store(segment(i) + arena_at(), memory_order_relaxed);
+            arena_ptr->end = segment(i) + node_bytes;
+        }
+    }
+    else
+    {
+        auto deadline = chrono::steady_clock::now() + 10s;
+        while (header->ready.load(memory_order_acquire) == 0 && chrono::steady_clock::now() < deadline)
+        {
+            this_thread::sleep_for(1ms);
+        }
+        if (header->ready.load(memory_order_acquire) == 0 || memcmp(header->magic, SHM_MAGIC, sizeof(SHM_MAGIC)) != 0 ||
+            header->region_size != mapped_size)
+        {
+            munmap(base, mapped_size);
+            throw runtime_error("invalid shared memory table " + name);
+        }
+    }
+
+    // segment마다 해당 NUMA node에 page를 두도록 한다. policy는 mapping 별이므로 모든 process가 건다.
+    // 실패해도 (node가 하나뿐이거나 권한이 없을 때) 동작에는 문제가 없으므로 무시한다.
+    for (unsigned i = 0; i < header->node_num; ++i)
+    {
+        unsigned long mask = 1ul << real_node(i);
+        mbind(base + segment(i), header->node_bytes, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+    }
+
+    // 죽은 process가 남긴 slot은 재사용한다.
+    const auto self = proc_id(getpid());
+    for (proc = 0; proc < SHM_MAX_PROCS; ++proc)
+    {
+        auto id = header->procs[proc].load(memory_order_acquire);
+        if (id != 0 && process_alive(id))
+            continue;
+        if (header->procs[proc].compare_exchange_strong(id, self))
+            break;
+    }
+    if (proc == SHM_MAX_PROCS)
+    {
+        munmap(base, mapped_size);
+        throw runtime_error("too many processes attached to " + name);
+    }
+    for (auto &slot : header->epochs[proc])
+    {
+        slot.epoch.store(ULLONG_MAX, memory_order_release);
+    }
+
+    if (creator)
+    {
+        // 0번 bucket의 dummy node
+        auto first_bucket = alloc_node(0, 0);
+        header->head.next.store(first_bucket, memory_order_relaxed);
+        for (unsigned i = 0; i < node_num; ++i)
+        {
+            buckets(i)[0].store(first_bucket, memory_order_relaxed);
+        }
+        header->ready.store(1, memory_order_release);
+    }
+}
+
+ShmHashtable::~ShmHashtable()
+{
+    for (auto &ts : threads)
+    {
+        reclaim(ts, false);
+        if (false == ts.retired.empty())
+        {
+            lock_guard<ShmMutex> guard{header->orphan_lock};
+            auto orphan_num = header->orphan_num.load(memory_order_relaxed);
+            const auto room = min<size_t>(SHM_ORPHAN_MAX - orphan_num, ts.retired.size());
+            for (size_t i = 0; i < room; ++i)
+            {
+                header->orphans[orphan_num++] = ShmOrphan{ts.retired[i].first, ts.retired[i].second};
+            }
+            header->orphan_num.store(orphan_num, memory_order_release);
+            // 자리가 없으면 그 노드는 region이 지워질 때까지 쓰지 못한다. leaked()로 알 수 있게 센다.
+            if (room < ts.retired.size())
+                header->leaked_num.fetch_add(ts.retired.size() - room, memory_order_relaxed);
+        }
+        flush_cache(ts);
+    }
+    for (auto &slot : header->epochs[proc])
+    {
+        slot.epoch.store(ULLONG_MAX, memory_order_release);
+    }
+    header->procs[proc].store(0, memory_order_release);
+    munmap(base, mapped_size);
+}
+
+void ShmHashtable::unlink(const string &name)
+{
+    shm_unlink(name.c_str());
+}
+
+ShmOffset ShmHashtable::arena_at() const
+{
+    return SHM_BUCKETS_AT + header->max_buckets * sizeof(ShmOffset);
+}
+
+ShmOffset ShmHashtable::head_offset() const
+{
+    return reinterpret_cast<const char *>(&header->head) - base;
+}
+
+ShmOffset ShmHashtable::segment(unsigned node_idx) const
+{
+    return SHM_HEADER_BYTES + node_idx * header->node_bytes;
+}
+
+ShmArena *ShmHashtable::arena(unsigned node_idx) const
+{
+    return reinterpret_cast<ShmArena *>(base + segment(node_idx));
+}
+
+atomic<ShmOffset> *ShmHashtable::buckets(unsigned node_idx) const
+{
+    return reinterpret_cast<atomic<ShmOffset> *>(base + segment(node_idx) + SHM_BUCKETS_AT);
+}
+
+unsigned ShmHashtable::local_node() const
+{
+    return current_node() % header->node_num;
+}
+
+void ShmHashtable::start_op()
+{
+    header->epochs[proc][thread_slot()].epoch.store(header->global_epoch.load(memory_order_relaxed), memory_order_seq_cst);
+}
+
+void ShmHashtable::end_op()
+{
+    header->epochs[proc][thread_slot()].epoch.store(ULLONG_MAX, memory_order_release);
+}
+
+// 모든 process의 thread 중 가장 오래된 epoch. 죽은 process의 slot은 여기서 정리한다.
+unsigned long long ShmHashtable::min_active_epoch()
+{
+    auto min_epoch = ULLONG_MAX;
+    for (unsigned p = 0; p < SHM_MAX_PROCS; ++p)
+    {
+        auto id = header->procs[p].load(memory_order_acquire);
+        if (id == 0)
+            continue;
+        if (false == process_alive(id))
+        {
+            for (auto &slot : header->epochs[p])
+                slot.epoch.store(ULLONG_MAX, memory_order_release);
+            header->procs[p].compare_exchange_strong(id, 0);
+            continue;
+        }
+        for (auto &slot : header->epochs[p])
+        {
+            min_epoch = min(min_epoch, slot.epoch.load(memory_order_acquire));
+        }
+    }
+    return min_epoch;
+}
+
+void ShmHashtable::retire(ShmOffset offset)
+{
+    auto &ts = threads[thread_slot()];
+    ts.retired.emplace_back(offset, header->global_epoch.load(memory_order_relaxed));
+    ++ts.counter;
+    if (ts.counter % shm_epoch_freq == 0)
+        header->global_epoch.fetch_add(1, memory_order_relaxed);
+    if (ts.counter % shm_empty_freq == 0)
+        reclaim(ts, true);
+}
+
+void ShmHashtable::reclaim(ThreadState &ts, bool adopt_orphans)
+{
+    auto min_epoch = min_active_epoch();
+    auto removed_it = remove_if(ts.retired.begin(), ts.retired.end(), [this, min_epoch](auto &r_node) {
+        if (r_node.second < min_epoch)
+        {
+            free_node(r_node.first);
+            return true;
+        }
+        return false;
+    });
+    ts.retired.erase(removed_it, ts.retired.end());
+
+    if (false == adopt_orphans || header->orphan_num.load(memory_order_acquire) == 0)
+        return;
+    lock_guard<ShmMutex> guard{header->orphan_lock};
+    auto orphan_num = header->orphan_num.load(memory_order_relaxed);
+    for (unsigned i = 0; i < orphan_num;)
+    {
+        if (header->orphans[i].epoch < min_epoch)
+        {
+            // 여기서 죽어도 같은 노드를 두번 해제하지 않도록 list에서 먼저 빼고 해제한다.
+            auto offset = header->orphans[i].offset;
+            auto last = header->orphans[--orphan_num];
+            header->orphan_num.store(orphan_num, memory_order_release);
+            header->orphans[i] = last;
+            free_node(offset);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+}
+
+ShmOffset ShmHashtable::alloc_node(unsigned long key, unsigned long value)
+{
+    auto &ts = threads[thread_slot()];
+    auto node_idx = local_node();
+    if (ts.node != node_idx)
+    {
+        flush_cache(ts);
+        ts.node = node_idx;
+        ts.bump = ts.bump_end = 0;
+    }
+
+    if (ts.cache.empty())
+    {
+        auto arena_ptr = arena(node_idx);
+        lock_guard<ShmMutex> guard{arena_ptr->lock};
+        for (unsigned i = 0; i < SHM_REFILL_NUM && arena_ptr->free_head != 0; ++i)
+        {
+            ts.cache.push_back(arena_ptr->free_head);
+            arena_ptr->free_head = node(arena_ptr->free_head)->next.load(memory_order_relaxed);
+        }
+    }
+
+    ShmOffset offset;
+    if (false == ts.cache.empty())
+    {
+        offset = ts.cache.back();
+        ts.cache.pop_back();
+    }
+    else
+    {
+        if (ts.bump + sizeof(ShmNode) > ts.bump_end)
+        {
+            auto arena_ptr = arena(node_idx);
+            auto chunk = arena_ptr->bump.fetch_add(SHM_CHUNK_SIZE, memory_order_relaxed);
+            if (chunk + SHM_CHUNK_SIZE > arena_ptr->end)
+                throw runtime_error("shared memory node arena is full");
+            ts.bump = chunk;
+            ts.bump_end = chunk + SHM_CHUNK_SIZE;
+        }
+        offset = ts.bump;
+        ts.bump += sizeof(ShmNode);
+    }
+
+    auto new_node = node(offset);
+    new_node->key = key;
+    new_node->value = value;
+    new_node->next.store(0, memory_order_relaxed);
+    new_node->home = node_idx;
+    return offset;
+}
+
+// 노드를 만든 node의 arena로 돌려준다.
+void ShmHashtable::free_node(ShmOffset offset)
+{
+    auto arena_ptr = arena(node(offset)->home);
+    lock_guard<ShmMutex> guard{arena_ptr->lock};
+    node(offset)->next.store(arena_ptr->free_head, memory_order_relaxed);
+    arena_ptr->free_head = offset;
+}
+
+void ShmHashtable::flush_cache(ThreadState &ts)
+{
+    for (auto offset : ts.cache)
+    {
+        free_node(offset);
+    }
+    ts.cache.clear();
+}
+
+bool ShmHashtable::find_node(ShmOffset from, unsigned long key, ShmOffset &pred, ShmOffset &curr)
+{
+retry:
+    pred = from;
+    curr = node(pred)->next.load(memory_order_acquire) & ~SHM_MARK;
+    while (true)
+    {
+        if (curr == 0)
+            return false;
+        auto curr_node = node(curr);
+        remote_access(curr_node->home);
+        auto succ = curr_node->next.load(memory_order_acquire);
+        if (0 != (succ & SHM_MARK))
+        {
+            auto expected = curr;
+            SO_PERTURB();
+            if (false == node(pred)->next.compare_exchange_strong(expected, succ & ~SHM_MARK))
+                goto retry;
+            retire(curr);
+        }
+        else if (curr_node->key >= key)
+        {
+            return curr_node->key == key;
+        }
+        else
+        {
+            pred = curr;
+        }
+        curr = succ & ~SHM_MARK;
+        SO_PERTURB();
+    }
+}
+
+// 성공하면 new_node, 같은 key의 노드가 이미 있으면 그 노드의 offset 반환
+ShmOffset ShmHashtable::add_node(ShmOffset from, ShmOffset new_node)
+{
+    ShmOffset pred, curr;
+    const auto key = node(new_node)->key;
+    while (true)
+    {
+        start_op();
+        if (true == find_node(from, key, pred, curr))
+        {
+            end_op();
+            return curr;
+        }
+        node(new_node)->next.store(curr, memory_order_relaxed);
+        auto expected = curr;
+        SO_PERTURB();
+        bool linked = node(pred)->next.compare_exchange_strong(expected, new_node);
+        end_op();
+        if (linked)
+            return new_node;
+    }
+}
+
+ShmOffset ShmHashtable::init_bucket(atomic<ShmOffset> *replica, uintptr_t bucket)
+{
+    auto parent = get_parent(bucket);
+    auto parent_node = replica[parent].load(memory_order_acquire);
+    if (parent_node == 0)
+        parent_node = init_bucket(replica, parent);
+
+    auto dummy = alloc_node(so_dummy_key(bucket), 0);
+    auto added = add_node(parent_node, dummy);
+    if (added != dummy)
+        threads[thread_slot()].cache.push_back(dummy);
+    replica[bucket].store(added, memory_order_release);
+    return added;
+}
+
+ShmOffset ShmHashtable::get_bucket(unsigned long key)
+{
+    auto replica = buckets(local_node());
+    auto bucket = key % header->bucket_num.load(memory_order_relaxed);
+    auto bucket_node = replica[bucket].load(memory_order_acquire);
+    if (bucket_node == 0)
+        bucket_node = init_bucket(replica, bucket);
+    return bucket_node;
+}
+
+bool ShmHashtable::insert(unsigned long key, unsigned long value)
+{
+    auto bucket_node = get_bucket(key);
+    auto new_node = alloc_node(so_regular_key(key), value);
+    if (add_node(bucket_node, new_node) != new_node)
+    {
+        // 공개된 적 없는 노드이므로 바로 재사용한다.
+        threads[thread_slot()].cache.push_back(new_node);
+        return false;
+    }
+
+    // 다른 process의 helper thread에 의존하지 않도록 bucket 수는 insert 한 thread가 직접 늘린다.
+    auto items = header->item_num.fetch_add(1, memory_order_relaxed) + 1;
+    auto bucket_num = header->bucket_num.load(memory_order_relaxed);
+    if (items / bucket_num >= LOAD_FACTOR && bucket_num * 2 <= header->max_buckets)
+        header->bucket_num.compare_exchange_strong(bucket_num, bucket_num * 2);
+    return true;
+}
+
+bool ShmHashtable::remove(unsigned long key)
+{
+    auto bucket_node = get_bucket(key);
+    const auto so_key = so_regular_key(key);
+    ShmOffset pred, curr;
+    while (true)
+    {
+        start_op();
+        if (false == find_node(bucket_node, so_key, pred, curr))
+        {
+            end_op();
+            return false;
+        }
+        auto succ = node(curr)->next.load(memory_order_acquire) & ~SHM_MARK;
+        auto expected = succ;
+        SO_PERTURB();
+        if (false == node(curr)->next.compare_exchange_strong(expected, succ | SHM_MARK))
+        {
+            end_op();
+            continue;
+        }
+        expected = curr;
+        SO_PERTURB();
+        if (node(pred)->next.compare_exchange_strong(expected, succ))
+            retire(curr);
+        end_op();
+        header->item_num.fetch_sub(1, memory_order_relaxed);
+        return true;
+    }
+}
+
+optional<unsigned long> ShmHashtable::find(unsigned long key)
+{
+    auto bucket_node = get_bucket(key);
+    const auto so_key = so_regular_key(key);
+    optional<unsigned long> ret;
+    start_op();
+    auto curr = bucket_node;
+    while (curr != 0 && node(curr)->key < so_key)
+    {
+        remote_access(node(curr)->home);
+        curr = node(curr)->next.load(memory_order_acquire) & ~SHM_MARK;
+        SO_PERTURB();
+    }
+    if (curr != 0 && node(curr)->key == so_key && 0 == (node(curr)->next.load(memory_order_acquire) & SHM_MARK))
+        ret = node(curr)->value;
+    end_op();
+    return ret;
+}
+
+// 지울 key를 모은 뒤 일반 remove로 지운다. 다른 process도 같은 list를 보므로 sweeper thread를 따로 두지 않는다.
+size_t ShmHashtable::erase_if(const function<bool(unsigned long, unsigned long)> &pred)
+{
+    vector<unsigned long> keys;
+    start_op();
+    for (auto curr = header->head.next.load(memory_order_acquire) & ~SHM_MARK; curr != 0;
+         curr = node(curr)->next.load(memory_order_acquire) & ~SHM_MARK)
+    {
+        auto curr_node = node(curr);
+        if ((curr_node->key & 0x1) == 0 || 0 != (curr_node->next.load(memory_order_acquire) & SHM_MARK))
+            continue;
+        auto key = reverse_bits(curr_node->key) & ~SHM_KEY_MASK;
+        if (pred(key, curr_node->value))
+            keys.push_back(key);
+    }
+    end_op();
+
+    size_t erased = 0;
+    for (auto key : keys)
+    {
+        erased += remove(key) ? 1 : 0;
+    }
+    return erased;
+}
+
+size_t ShmHashtable::check_replicas()
+{
+    size_t mismatch = 0;
+    start_op();
+    for (auto curr = header->head.next.load(memory_order_acquire) & ~SHM_MARK; curr != 0;
+         curr = node(curr)->next.load(memory_order_acquire) & ~SHM_MARK)
+    {
+        if ((node(curr)->key & 0x1) != 0)
+            continue;
+        auto bucket = reverse_bits(node(curr)->key);
+        // replica는 각 node의 thread가 처음 쓸 때 채우므로 비어 있는 것은 괜찮다.
+        for (unsigned i = 0; i < header->node_num; ++i)
+        {
+            auto entry = buckets(i)[bucket].load(memory_order_acquire);
+            if (entry != 0 && entry != curr)
+                ++mismatch;
+        }
+    }
+    end_op();
+    return mismatch;
+}
+
+} // namespace so
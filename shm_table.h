@@ -0,0 +1,160 @@
+#ifndef A5B0E7C2_93A4_4F61_8D27_C1E6A9F3B480
+#define A5B0E7C2_93A4_4F61_8D27_C1E6A9F3B480
+
+#include <atomic>
+#include <functional>
+#include <pthread.h>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "lf_set.h"
+
+namespace so
+{
+
+// 여러 process가 같은 table을 쓰도록 list, node arena, node별 bucket array를 이름 있는 shared memory에 둔다.
+// process마다 mapping 주소가 다르므로 pointer 대신 region 시작부터의 offset을 저장한다. (0은 nullptr)
+// region layout: ShmHeader 뒤에 NUMA node마다 node_bytes 크기의 segment가 이어진다.
+// segment는 ShmArena, bucket array replica, node arena 순서이고, segment마다 mbind로 해당 node에 메모리를 둔다.
+// bucket array replica는 region을 만들 때 정한 max_buckets 크기로 미리 잡아두므로 bucket 수는 그 이상 늘지 않는다.
+// (기본 1M개, node마다 8MB) 그보다 item이 많으면 bucket당 list가 길어질 뿐 동작은 한다.
+constexpr char SHM_MAGIC[8] = {'S', 'O', 'S', 'H', 'M', '0', '0', '2'};
+constexpr unsigned SHM_MAX_PROCS = 16;
+constexpr unsigned long SHM_DEFAULT_MAX_BUCKETS = 1 << 20;
+constexpr size_t SHM_DEFAULT_NODE_BYTES = 256ul << 20;
+constexpr size_t SHM_CHUNK_SIZE = 64 * 1024; // thread가 node arena에서 한번에 떼어가는 크기
+constexpr unsigned SHM_ORPHAN_MAX = 1 << 16;
+
+using ShmOffset = uint64_t;
+
+struct ShmNode
+{
+    uint64_t key;
+    uint64_t value;
+    std::atomic<ShmOffset> next; // 다음 노드의 offset | mark bit
+    uint8_t home;
+};
+static_assert(sizeof(ShmNode) == 32, "ShmNode must stay 32 bytes");
+
+// 다른 process와도 공유하는 lock. lock을 쥔 process가 죽어도 다른 process들이 멈추지 않도록 robust mutex를 쓴다.
+// 죽은 process가 쥐고 있던 lock은 다음 lock()이 넘겨받는다. 그래서 이 lock이 보호하는 자료는 수정하는 중간에도
+// 항상 일관된 상태로 두어야 한다. (죽은 process가 들고 있던 노드가 새는 것은 허용)
+struct ShmMutex
+{
+    pthread_mutex_t mutex;
+
+    // region을 만든 process가 한번만 호출한다.
+    void init();
+    void lock();
+    void unlock() { pthread_mutex_unlock(&mutex); }
+};
+
+struct alignas(64) ShmEpochSlot
+{
+    std::atomic_ullong epoch;
+};
+
+// NUMA node 하나의 node arena. 해제된 노드는 next field로 free list에 이어진다.
+struct ShmArena
+{
+    std::atomic<ShmOffset> bump;
+    ShmOffset end;
+    ShmMutex lock;
+    ShmOffset free_head;
+};
+
+// detach 할 때까지 회수하지 못한 노드. 다른 process가 epoch이 지난 뒤 회수한다.
+struct ShmOrphan
+{
+    ShmOffset offset;
+    unsigned long long epoch;
+};
+
+struct ShmHeader
+{
+    char magic[8];
+    std::atomic_uint ready;
+    uint32_t node_num;
+    uint64_t region_size;
+    uint64_t node_bytes;
+    uint64_t max_buckets;
+    std::atomic_ullong bucket_num;
+    std::atomic_ullong item_num;
+    std::atomic_ullong global_epoch;
+    ShmNode head;
+    // 등록한 process의 pid와 시작 시각 (proc_id()). 0이면 빈 slot. 시작 시각을 같이 보므로 pid가 재사용되어도 구별된다.
+    std::atomic_ullong procs[SHM_MAX_PROCS];
+    ShmEpochSlot epochs[SHM_MAX_PROCS][MAX_THREAD];
+    ShmMutex orphan_lock;
+    std::atomic_uint orphan_num;
+    std::atomic_ullong leaked_num; // orphan list가 가득 차서 넘기지 못하고 버린 노드 수
+    ShmOrphan orphans[SHM_ORPHAN_MAX];
+};
+
+class ShmHashtable
+{
+public:
+    // name의 region이 없으면 만들고 있으면 연다. node_num, node_bytes, max_buckets는 처음 만들 때만 쓰인다.
+    // max_buckets는 2의 거듭제곱이어야 한다.
+    ShmHashtable(const std::string &name, unsigned node_num, size_t node_bytes = SHM_DEFAULT_NODE_BYTES,
+                 unsigned long max_buckets = SHM_DEFAULT_MAX_BUCKETS);
+    ~ShmHashtable();
+    ShmHashtable(const ShmHashtable &) = delete;
+    // region 이름을 지운다. 이미 연 process들은 detach 할 때까지 계속 쓸 수 있다.
+    static void unlink(const std::string &name);
+
+    bool insert(unsigned long key, unsigned long value);
+    bool remove(unsigned long key);
+    std::optional<unsigned long> find(unsigned long key);
+    size_t erase_if(const std::function<bool(unsigned long, unsigned long)> &pred);
+    // 어떤 replica에서 다른 dummy node를 가리키는 bucket의 수 (테스트용)
+    size_t check_replicas();
+    size_t size() const { return header->item_num.load(std::memory_order_relaxed); }
+    // detach 하는 process가 orphan list에 넘기지 못해 region이 지워질 때까지 쓸 수 없게 된 노드 수
+    size_t leaked() const { return header->leaked_num.load(std::memory_order_relaxed); }
+
+private:
+    // process 안에서 thread_slot()별로 두는 상태. 같은 slot을 동시에 쓰는 thread는 없다.
+    struct alignas(64) ThreadState
+    {
+        unsigned node = UINT_MAX;
+        ShmOffset bump = 0;
+        ShmOffset bump_end = 0;
+        std::vector<ShmOffset> cache;
+        std::vector<std::pair<ShmOffset, unsigned long long>> retired;
+        unsigned counter = 0;
+    };
+
+    char *base;
+    size_t mapped_size;
+    ShmHeader *header;
+    unsigned proc;
+    ThreadState threads[MAX_THREAD];
+
+    ShmNode *node(ShmOffset offset) const { return reinterpret_cast<ShmNode *>(base + offset); }
+    ShmOffset head_offset() const;
+    ShmOffset segment(unsigned node_idx) const;
+    ShmOffset arena_at() const;
+    ShmArena *arena(unsigned node_idx) const;
+    std::atomic<ShmOffset> *buckets(unsigned node_idx) const;
+    unsigned local_node() const;
+
+    void start_op();
+    void end_op();
+    unsigned long long min_active_epoch();
+    void retire(ShmOffset offset);
+    void reclaim(ThreadState &ts, bool adopt_orphans);
+    ShmOffset alloc_node(unsigned long key, unsigned long value);
+    void free_node(ShmOffset offset);
+    void flush_cache(ThreadState &ts);
+
+    bool find_node(ShmOffset from, unsigned long key, ShmOffset &pred, ShmOffset &curr);
+    ShmOffset add_node(ShmOffset from, ShmOffset new_node);
+    ShmOffset get_bucket(unsigned long key);
+    ShmOffset init_bucket(std::atomic<ShmOffset> *replica, uintptr_t bucket);
+};
+
+} // namespace so
+
+#endif /* A5B0E7C2_93A4_4F61_8D27_C1E6A9F3B480 */
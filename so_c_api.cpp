@@ -0,0 +1,136 @@
+#include <cstring>
+#include <exception>
+#include <string>
+#include "so_c_api.h"
+#include "split_ordered.h"
+#include "topology.h"
+
+using namespace std;
+
+struct so_table
+{
+    so::SO_Hashtable table;
+
+    so_table(unsigned node_num, const so::SO_Options &options) : table{node_num, options} {}
+};
+
+static thread_local string t_last_error;
+
+// C++ 예외를 C 경계 밖으로 내보내지 않고 error 값으로 바꾼다.
+template <typename Func, typename Ret>
+static Ret guard(Func &&func, Ret error)
+{
+    try
+    {
+        return func();
+    }
+    catch (const exception &e)
+    {
+        t_last_error = e.what();
+    }
+    catch (...)
+    {
+        t_last_error = "unknown error";
+    }
+    return error;
+}
+
+static so_table *create_table(unsigned node_num, const so::SO_Options &options)
+{
+    return guard([&]() -> so_table * { return new so_table{node_num, options}; }, (so_table *)nullptr);
+}
+
+so_table *so_table_create(unsigned node_num)
+{
+    return create_table(node_num, so::SO_Options{});
+}
+
+so_table *so_table_open_shared(const char *name, unsigned node_num)
+{
+    so::SO_Options options;
+    options.engine = so::Engine::SHARED_MEMORY;
+    options.shm_name = name;
+    return create_table(node_num, options);
+}
+
+void so_table_destroy(so_table *table)
+{
+    delete table;
+}
+
+int so_insert(so_table *table, unsigned long key, unsigned long value)
+{
+    return guard([&] { return table->table.insert(key, value) ? 1 : 0; }, -1);
+}
+
+int so_insert_ttl(so_table *table, unsigned long key, unsigned long value, unsigned long ttl_ms)
+{
+    return guard([&] { return table->table.insert(key, value, chrono::milliseconds{ttl_ms}) ? 1 : 0; }, -1);
+}
+
+int so_remove(so_table *table, unsigned long key)
+{
+    return guard([&] { return table->table.remove(key) ? 1 : 0; }, -1);
+}
+
+int so_find(so_table *table, unsigned long key, unsigned long *value)
+{
+    return guard([&] {
+        auto found = table->table.find(key);
+        if (!found)
+            return 0;
+        if (value != nullptr)
+            *value = *found;
+        return 1;
+    }, -1);
+}
+
+int so_insert_bytes(so_table *table, const void *key, size_t key_len, const void *value, size_t value_len)
+{
+    return guard([&] {
+        return table->table.insert(string_view{static_cast<const char *>(key), key_len},
+                                   string_view{static_cast<const char *>(value), value_len}) ? 1 : 0;
+    }, -1);
+}
+
+int so_remove_bytes(so_table *table, const void *key, size_t key_len)
+{
+    return guard([&] { return table->table.remove(string_view{static_cast<const char *>(key), key_len}) ? 1 : 0; }, -1);
+}
+
+int so_find_bytes(so_table *table, const void *key, size_t key_len, void *buf, size_t buf_len, size_t *value_len)
+{
+    return guard([&] {
+        auto found = table->table.find(string_view{static_cast<const char *>(key), key_len});
+        if (!found)
+            return 0;
+        if (buf != nullptr)
+            memcpy(buf, found->data(), min(buf_len, found->size()));
+        if (value_len != nullptr)
+            *value_len = found->size();
+        return 1;
+    }, -1);
+}
+
+long so_erase_if(so_table *table, int (*pred)(unsigned long key, unsigned long value, void *ctx), void *ctx)
+{
+    return guard([&] {
+        return (long)table->table.erase_if([pred, ctx](unsigned long key, unsigned long value) { return pred(key, value, ctx) != 0; });
+    }, -1l);
+}
+
+int so_bind_thread(unsigned node)
+{
+    so::set_current_node(node);
+    if (false == so::run_on_node(node))
+    {
+        t_last_error = "can't bind the thread to node #" + to_string(node);
+        return -1;
+    }
+    return 0;
+}
+
+const char *so_last_error(void)
+{
+    return t_last_error.c_str();
+}
@@ -0,0 +1,50 @@
+#ifndef F3A9C1D7_6E24_4B8A_9D50_2C7E1B4A8F63
+#define F3A9C1D7_6E24_4B8A_9D50_2C7E1B4A8F63
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// C++이 아닌 서비스에서 쓰기 위한 얇은 C API. C++ 예외는 넘어오지 않는다.
+// 실패하면 -1 (또는 NULL)을 반환하고, 같은 thread에서 so_last_error()로 이유를 볼 수 있다.
+typedef struct so_table so_table;
+
+// split-ordered engine으로 node_num개의 NUMA node에 replica를 둔 table을 만든다.
+so_table *so_table_create(unsigned node_num);
+// 이름 있는 shared memory의 table을 만들거나 연다. 같은 이름을 쓰는 process들은 같은 table을 본다.
+so_table *so_table_open_shared(const char *name, unsigned node_num);
+void so_table_destroy(so_table *table);
+
+// 1이면 넣음, 0이면 이미 있음
+int so_insert(so_table *table, unsigned long key, unsigned long value);
+// ttl_ms가 지나면 없는 것으로 보인다. (split-ordered engine 전용)
+int so_insert_ttl(so_table *table, unsigned long key, unsigned long value, unsigned long ttl_ms);
+// 1이면 지움, 0이면 없음
+int so_remove(so_table *table, unsigned long key);
+// 1이면 찾아서 *value에 저장, 0이면 없음
+int so_find(so_table *table, unsigned long key, unsigned long *value);
+
+// byte string key/value. (split-ordered engine 전용)
+int so_insert_bytes(so_table *table, const void *key, size_t key_len, const void *value, size_t value_len);
+int so_remove_bytes(so_table *table, const void *key, size_t key_len);
+// 찾으면 value를 buf에 최대 buf_len byte 복사하고 *value_len에 value 전체 길이를 저장한다.
+int so_find_bytes(so_table *table, const void *key, size_t key_len, void *buf, size_t buf_len, size_t *value_len);
+
+// pred가 0이 아닌 값을 반환한 정수 key item을 지우고 지운 수를 반환한다.
+// so_table_create로 만든 table에서는 pred가 호출한 thread가 아니라 NUMA node마다 하나씩 만드는 sweeper thread에서
+// 동시에 불린다. 따라서 pred와 ctx는 thread-safe 해야 하고 (ctx를 고친다면 atomic 등으로), thread-local 상태에 기대면 안 된다.
+// 모든 sweeper가 끝난 뒤에 반환하므로 ctx는 호출이 끝날 때까지만 살아 있으면 된다.
+long so_erase_if(so_table *table, int (*pred)(unsigned long key, unsigned long value, void *ctx), void *ctx);
+
+// 현재 thread가 node의 replica를 쓰도록 하고 그 node의 CPU에 고정한다.
+int so_bind_thread(unsigned node);
+// 현재 thread에서 마지막으로 실패한 호출의 이유
+const char *so_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* F3A9C1D7_6E24_4B8A_9D50_2C7E1B4A8F63 */
@@ -1,25 +1,18 @@
+#include <algorithm>
 #include <thread>
+#include <stdexcept>
 #include "lf_set.h"
+#include "bytes_node.h"
 #include "split_ordered.h"
+#include "trace.h"
+#include "topology.h"
+#include "stress_hooks.h"
+#include "perf_counters.h"
 
-static const unsigned NUMA_NODE_NUM = numa_num_configured_nodes();
-static const unsigned CPU_NUM = numa_num_configured_cpus()/2;
-static const unsigned CORE_PER_NODE = CPU_NUM/NUMA_NODE_NUM;
+using namespace std;
 
-template <typename T, typename... Vals>
-T *NUMA_alloc(unsigned numa_id, Vals &&... val)
+namespace so
 {
-    void *raw_ptr = numa_alloc_onnode(sizeof(T), numa_id);
-    T *ptr = new (raw_ptr) T(forward<Vals>(val)...);
-    return ptr;
-}
-
-template <typename T>
-void NUMA_dealloc(T *ptr)
-{
-    ptr->~T();
-    numa_free(ptr, sizeof(T));
-}
 
 template <typename T>
 constexpr int width()
@@ -27,163 +20,662 @@ constexpr int width()
     return sizeof(T) * 8;
 }
 
-using namespace std;
+void BucketArray::set_bucket(uintptr_t bucket, LFNODE *head)
+{
+    auto segment = bucket / SEGMENT_SIZE;
+    auto &atomic_seg_ptr = this->segments[segment];
+    if (atomic_seg_ptr.load(memory_order_relaxed) == nullptr)
+    {
+        auto new_seg = new Segments<BucketRef>{};
+
+        Segments<BucketRef> *original = nullptr;
+        if (!atomic_seg_ptr.compare_exchange_strong(original, new_seg))
+        {
+            delete new_seg;
+        }
+    }
 
-// macros to generate the lookup table (at compile-time)
-#define R2(n) n, n + 2 * 64, n + 1 * 64, n + 3 * 64
-#define R4(n) R2(n), R2(n + 2 * 16), R2(n + 1 * 16), R2(n + 3 * 16)
-#define R6(n) R4(n), R4(n + 2 * 4), R4(n + 1 * 4), R4(n + 3 * 4)
-#define REVERSE_BITS R6(0), R6(2), R6(1), R6(3)
+    auto seg_ptr = atomic_seg_ptr.load(memory_order_relaxed);
+    (*seg_ptr)[bucket % SEGMENT_SIZE] = ref_of(head);
+}
 
-// lookup-table to store the reverse of each index of the table
-// The macro REVERSE_BITS generates the table
-static unsigned long lookup[256] = {REVERSE_BITS};
-static atomic_uint tid_counter{0};
-static thread_local unsigned tid = tid_counter.fetch_add(1, memory_order_relaxed);
-static thread_local const unsigned numa_id = (tid/CORE_PER_NODE) % NUMA_NODE_NUM;
-constexpr unsigned long KEY_MASK = ((unsigned long)1 << (width<unsigned long>() - 1));
+void BucketArray::set_bucket_if_present(uintptr_t bucket, LFNODE *head)
+{
+    auto seg_ptr = this->segments[bucket / SEGMENT_SIZE].load(memory_order_relaxed);
+    if (seg_ptr != nullptr)
+        (*seg_ptr)[bucket % SEGMENT_SIZE] = ref_of(head);
+}
 
-unsigned long reverse_bits(unsigned long num)
+size_t BucketArray::segment_num() const
 {
-    unsigned long result = 0;
-    for (unsigned long i = 0; i < sizeof(unsigned long); ++i)
+    size_t num = 0;
+    for (auto &seg : this->segments)
     {
-        result |= (lookup[(num >> (i * 8)) & 0xff] << ((sizeof(unsigned long) - i - 1) * 8));
+        num += seg.load(memory_order_relaxed) != nullptr ? 1 : 0;
     }
-    return result;
+    return num;
 }
 
-unsigned long so_regular_key(unsigned long key)
-{
-    return reverse_bits(key | KEY_MASK);
-}
+#ifdef SO_STRESS
+atomic_size_t stress_evicted_segments{0};
+atomic_size_t stress_freed_segments{0};
+#endif
 
-unsigned long so_dummy_key(unsigned long key)
+static void free_segment(void *seg)
 {
-    return reverse_bits(key);
+#ifdef SO_STRESS
+    stress_freed_segments.fetch_add(1, memory_order_relaxed);
+#endif
+    delete static_cast<Segments<BucketRef> *>(seg);
 }
 
-uintptr_t get_parent(uintptr_t bucket)
+LFNODE *SO_Hashtable::lookup_bucket(uintptr_t bucket)
 {
-    auto mask = (unsigned long)1 << (width<uintptr_t>() - 1);
-    for (auto i = 0; i < width<uintptr_t>(); ++i)
+    const auto node = replica_index();
+    if (this->partial_replication && node != this->fallback_replica.load(memory_order_relaxed))
+        return lookup_partial(node, bucket);
+    auto bucket_arr = this->bucket_array[node];
+    auto bucket_node = bucket_arr->get_bucket(bucket);
+    if (bucket_node == nullptr)
     {
-        if ((bucket & mask) != 0)
-        {
-            return bucket & ~mask;
-        }
-        mask >>= 1;
+        bucket_node = this->init_bucket(bucket_arr, bucket);
     }
-    return 0;
+    return bucket_node;
 }
 
-LFNODE *BucketArray::get_bucket(uintptr_t bucket)
+// 복제한 segment에 있으면 local에서, 아니면 home replica에서 읽는다.
+LFNODE *SO_Hashtable::lookup_partial(unsigned node, uintptr_t bucket)
 {
-    auto segment = bucket / SEGMENT_SIZE;
-    auto seg_ptr = this->segments[segment].load(memory_order_relaxed);
-    if (seg_ptr == nullptr)
+    static thread_local unsigned sample = 0;
+    const auto seg = bucket / SEGMENT_SIZE;
+    if ((++sample & (ACCESS_SAMPLE_RATE - 1)) == 0)
+        this->access_counts[node]->counts[seg].fetch_add(1, memory_order_relaxed);
+
+    // local helper가 segment를 버릴 수 있으므로 epoch 안에서 읽는다.
+    auto &local_seg = this->bucket_array[node]->segments[seg];
+    start_op();
+    auto seg_ptr = local_seg.load(memory_order_acquire);
+    LFNODE *bucket_node = seg_ptr == nullptr ? nullptr : this->bucket_array[node]->node_of((*seg_ptr)[bucket % SEGMENT_SIZE]);
+    end_op();
+    if (bucket_node != nullptr)
+        return bucket_node;
+
+    const auto home = this->fallback_replica.load(memory_order_relaxed);
+    auto home_arr = this->bucket_array[home];
+    remote_access(home);
+    bucket_node = home_arr->get_bucket(bucket);
+    if (bucket_node == nullptr)
     {
-        return nullptr;
+        bucket_node = this->init_bucket(home_arr, bucket);
     }
-    auto remain = bucket % SEGMENT_SIZE;
-    return (*seg_ptr)[remain];
+    // 복제본에 아직 전파되지 않은 entry이면 채워둔다.
+    if (seg_ptr != nullptr)
+    {
+        start_op();
+        seg_ptr = local_seg.load(memory_order_acquire);
+        if (seg_ptr != nullptr)
+            (*seg_ptr)[bucket % SEGMENT_SIZE] = BucketArray::ref_of(bucket_node);
+        end_op();
+    }
+    return bucket_node;
 }
 
-void BucketArray::set_bucket(uintptr_t bucket, LFNODE *head)
+// node의 local helper가 REPLICATION_INTERVAL마다 호출한다. sample 수를 보고 segment를 복제하거나 버린다.
+// 0번 segment는 첫 dummy node를 갖고 있으므로 항상 남긴다.
+void SO_Hashtable::rebalance_segments(unsigned node)
 {
-    auto segment = bucket / SEGMENT_SIZE;
-    auto &atomic_seg_ptr = this->segments[segment];
-    if (atomic_seg_ptr.load(memory_order_relaxed) == nullptr)
-    {
-        auto new_seg = new array<LFNODE *, SEGMENT_SIZE>;
-        for (auto &seg : *new_seg)
+    auto home_arr = this->bucket_array[this->fallback_replica.load(memory_order_relaxed)];
+    auto bucket_arr = this->bucket_array[node];
+    auto counts = this->access_counts[node];
+
+    // 복제한 뒤에 home에 반영된 entry는 notification을 못 받았을 수 있으므로 더 채울 것이 없을 때까지 채운다.
+    auto &refreshing = this->refreshing_segments[node];
+    auto refresh_end = remove_if(refreshing.begin(), refreshing.end(), [bucket_arr, home_arr](uintptr_t seg) {
+        auto seg_ptr = bucket_arr->segments[seg].load(memory_order_relaxed);
+        auto home_seg = home_arr->segments[seg].load(memory_order_acquire);
+        if (seg_ptr == nullptr)
+            return true;
+        bool filled = false;
+        for (unsigned i = 0; i < SEGMENT_SIZE; ++i)
         {
-            seg = nullptr;
+            if ((*seg_ptr)[i] == NO_BUCKET && (*home_seg)[i] != NO_BUCKET)
+            {
+                (*seg_ptr)[i] = (*home_seg)[i];
+                filled = true;
+            }
         }
+        return false == filled;
+    });
+    refreshing.erase(refresh_end, refreshing.end());
 
-        array<LFNODE *, SEGMENT_SIZE> *original = nullptr;
-        if (!atomic_seg_ptr.compare_exchange_strong(original, new_seg))
+    for (uintptr_t seg = 0; seg < SEGMENT_SIZE; ++seg)
+    {
+        auto home_seg = home_arr->segments[seg].load(memory_order_acquire);
+        if (home_seg == nullptr)
+            continue;
+        const auto samples = counts->counts[seg].exchange(0, memory_order_relaxed);
+        auto seg_ptr = bucket_arr->segments[seg].load(memory_order_relaxed);
+        if (seg_ptr == nullptr && samples >= SEGMENT_PROMOTE_SAMPLES)
         {
-            delete new_seg;
+            remote_access(this->fallback_replica.load(memory_order_relaxed));
+            bucket_arr->segments[seg].store(new Segments<BucketRef>{*home_seg}, memory_order_release);
+            refreshing.push_back(seg);
+        }
+        else if (seg_ptr != nullptr && seg != 0 && samples < SEGMENT_EVICT_SAMPLES)
+        {
+            bucket_arr->segments[seg].store(nullptr, memory_order_release);
+#ifdef SO_STRESS
+            stress_evicted_segments.fetch_add(1, memory_order_relaxed);
+#endif
+            retire_bulk(seg_ptr, free_segment);
         }
     }
-
-    auto seg_ptr = atomic_seg_ptr.load(memory_order_relaxed);
-    (*seg_ptr)[bucket % SEGMENT_SIZE] = head;
 }
 
-LFNODE *SO_Hashtable::init_bucket(uintptr_t bucket)
+LFNODE *SO_Hashtable::init_bucket(BucketArray *bucket_arr, uintptr_t bucket)
 {
-    auto bucket_arr = get_bucket_array();
     auto parent = get_parent(bucket);
     auto parent_node = bucket_arr->get_bucket(parent);
     if (parent_node == nullptr)
     {
-        parent_node = this->init_bucket(parent);
+        parent_node = this->init_bucket(bucket_arr, parent);
     }
+    SO_PERTURB();
+    ++t_op_counters.init_buckets;
+#ifdef SO_COMPACT_REFS
+    auto node = this->dummy_arena->alloc(so_dummy_key(bucket));
+    auto dummy = item_set.AddOrGet(*parent_node, *node);
+    if (dummy != node)
+        this->dummy_arena->free(node);
+#else
     auto dummy = item_set.Add(*parent_node, so_dummy_key(bucket));
+#endif
+    SO_PERTURB();
     bucket_arr->set_bucket(bucket, dummy);
     return dummy;
 }
 
 bool SO_Hashtable::remove(unsigned long key)
 {
-    auto bucket_arr = get_bucket_array();
+    if (recorder != nullptr)
+        recorder->record(TraceOp::REMOVE, key, 0);
+    if (nr_engine)
+        return nr_engine->remove(key);
+    if (shm_engine)
+        return shm_engine->remove(key);
+    if (delegation)
+        return delegation->execute(DelegatedOp::REMOVE, key, 0);
+    return remove_local(key);
+}
+
+bool SO_Hashtable::remove_local(unsigned long key)
+{
+    SlowOpProbe probe{slow_op_ns.load(memory_order_relaxed), SlowOpType::REMOVE, key};
     auto bucket_num = get_bucket_num();
 
-    auto bucket = key % bucket_num->load(memory_order_relaxed);
-    auto bucket_node = bucket_arr->get_bucket(bucket);
-    if (bucket_node == nullptr)
+    const auto bucket = key % bucket_num->load(memory_order_relaxed);
+    probe.set_bucket(bucket);
+    auto bucket_node = this->lookup_bucket(bucket);
+    const auto so_key = so_regular_key(key);
+    uint64_t seq;
     {
-        bucket_node = this->init_bucket(bucket);
+        ChangeOrder order{this->change_locks.get(), &so_key, 1};
+        if (false == this->item_set.Remove(*bucket_node, so_key))
+            return false;
+        SO_PERTURB();
+        seq = order.stamp(this->change_seq);
     }
-    if (false == this->item_set.Remove(*bucket_node, so_regular_key(key)))
-        return false;
-
+    if (seq != 0)
+        record_change(seq, ChangeType::REMOVE, key, 0);
     return true;
 }
 
 optional<unsigned long> SO_Hashtable::find(unsigned long key)
 {
-    auto bucket_arr = get_bucket_array();
+    if (recorder != nullptr)
+        recorder->record(TraceOp::FIND, key, 0);
+    if (nr_engine)
+        return nr_engine->find(key);
+    if (shm_engine)
+        return shm_engine->find(key);
+    SlowOpProbe probe{slow_op_ns.load(memory_order_relaxed), SlowOpType::FIND, key};
     auto bucket_num = get_bucket_num();
 
-    auto bucket = key % bucket_num->load(memory_order_relaxed);
-    auto bucket_node = bucket_arr->get_bucket(bucket);
-    if (bucket_node == nullptr)
-    {
-        bucket_node = this->init_bucket(bucket);
-    }
-    return this->item_set.Contains(*this->bucket_array[numa_id]->get_bucket(bucket), so_regular_key(key));
+    const auto bucket = key % bucket_num->load(memory_order_relaxed);
+    probe.set_bucket(bucket);
+    auto bucket_node = this->lookup_bucket(bucket);
+    return this->item_set.Contains(*bucket_node, so_regular_key(key));
 }
 
 bool SO_Hashtable::insert(unsigned long key, unsigned long value)
 {
-    auto bucket_arr = get_bucket_array();
+    if (recorder != nullptr)
+        recorder->record(TraceOp::INSERT, key, value);
+    if (nr_engine)
+        return nr_engine->insert(key, value);
+    if (shm_engine)
+        return shm_engine->insert(key, value);
+    if (delegation)
+        return delegation->execute(DelegatedOp::INSERT, key, value);
+    return insert_local(key, value);
+}
+
+bool SO_Hashtable::insert(unsigned long key, unsigned long value, chrono::milliseconds ttl)
+{
+    if (nr_engine || shm_engine)
+        throw runtime_error("TTL is only supported by the split-ordered engine");
+    if (recorder != nullptr)
+        recorder->record(TraceOp::INSERT, key, value, (uint32_t)min<long long>(max<long long>(ttl.count(), 1), UINT32_MAX));
+    has_expiry.store(true, memory_order_relaxed);
+    // owner thread에게는 expiry를 넘길 수 없으므로 delegation 중에도 바로 실행한다.
+    return insert_local(key, value, ttl_expire_at(ttl));
+}
+
+bool SO_Hashtable::insert_local(unsigned long key, unsigned long value, uint32_t expire_at)
+{
+    SlowOpProbe probe{slow_op_ns.load(memory_order_relaxed), SlowOpType::INSERT, key};
     auto bucket_num = get_bucket_num();
 
     auto node = new LFNODE{so_regular_key(key), value};
-    auto bucket = key % bucket_num->load(memory_order_relaxed);
-    auto bucket_node = bucket_arr->get_bucket(bucket);
-    if (bucket_node == nullptr)
+    node->home = current_node();
+    node->expire_at = expire_at;
+    const auto bucket = key % bucket_num->load(memory_order_relaxed);
+    probe.set_bucket(bucket);
+    auto bucket_node = this->lookup_bucket(bucket);
+    uint64_t seq;
     {
-        bucket_node = this->init_bucket(bucket);
+        ChangeOrder order{this->change_locks.get(), &node->key, 1};
+        if (!this->item_set.Add(*bucket_node, *node))
+        {
+            delete node;
+            return false;
+        }
+        SO_PERTURB();
+        seq = order.stamp(this->change_seq);
     }
-    if (!this->item_set.Add(*bucket_node, *node))
+    if (seq != 0)
+        record_change(seq, ChangeType::INSERT, key, value, expire_at);
+    return true;
+}
+
+// byte string key는 hash를 정수 key처럼 써서 bucket과 split-ordered key를 정한다.
+static BytesKey make_bytes_key(string_view key)
+{
+    auto hash = std::hash<string_view>{}(key);
+    return BytesKey{so_regular_key(hash & ~KEY_MASK), hash, key};
+}
+
+LFNODE *SO_Hashtable::get_bucket_node(unsigned long key, SlowOpProbe *probe)
+{
+    if (nr_engine || shm_engine)
+        throw runtime_error("byte string keys and multi-key updates are only supported by the split-ordered engine");
+    const auto bucket = (key & ~KEY_MASK) % get_bucket_num()->load(memory_order_relaxed);
+    if (probe != nullptr)
+        probe->set_bucket(bucket);
+    return this->lookup_bucket(bucket);
+}
+
+// byte string key는 hash를 key로 기록한다.
+bool SO_Hashtable::insert(string_view key, string_view value)
+{
+    auto target = make_bytes_key(key);
+    SlowOpProbe probe{slow_op_ns.load(memory_order_relaxed), SlowOpType::INSERT, target.hash};
+    auto bucket_node = get_bucket_node(target.hash, &probe);
+    auto node = new_bytes_node(target, value);
+    if (!this->item_set.AddBytes(*bucket_node, *node))
     {
-        delete node;
+        free_bytes_node(node);
         return false;
     }
     return true;
 }
 
-void global_helper_thread_func(LFSET *set, std::vector<SPSCQueue<BucketNotification> *> *queues, bitmask* node_mask)
+bool SO_Hashtable::remove(string_view key)
 {
-    numa_run_on_node_mask(node_mask);
-    numa_bitmask_free(node_mask);
-    while (true)
+    auto target = make_bytes_key(key);
+    SlowOpProbe probe{slow_op_ns.load(memory_order_relaxed), SlowOpType::REMOVE, target.hash};
+    return this->item_set.RemoveBytes(*get_bucket_node(target.hash, &probe), target);
+}
+
+optional<string> SO_Hashtable::find(string_view key)
+{
+    auto target = make_bytes_key(key);
+    SlowOpProbe probe{slow_op_ns.load(memory_order_relaxed), SlowOpType::FIND, target.hash};
+    return this->item_set.ContainsBytes(*get_bucket_node(target.hash, &probe), target);
+}
+
+bool SO_Hashtable::multi_update(const vector<MultiOp> &ops)
+{
+    vector<pair<LFNODE *, MultiOp>> so_ops;
+    vector<unsigned long> so_keys;
+    for (auto &op : ops)
+    {
+        so_ops.emplace_back(get_bucket_node(op.key), MultiOp{op.type, so_regular_key(op.key), op.value});
+        so_keys.push_back(so_ops.back().second.key);
+    }
+    uint64_t seq;
+    {
+        ChangeOrder order{this->change_locks.get(), so_keys.data(), so_keys.size()};
+        if (false == this->item_set.MultiUpdate(move(so_ops)))
+            return false;
+        SO_PERTURB();
+        seq = order.stamp(this->change_seq, ops.size());
+    }
+    if (seq != 0)
+    {
+        for (auto &op : ops)
+        {
+            const auto type = op.type == MultiOpType::INSERT ? ChangeType::INSERT
+                              : op.type == MultiOpType::REMOVE ? ChangeType::REMOVE
+                                                               : ChangeType::UPDATE;
+            record_change(seq++, type, op.key, op.type == MultiOpType::REMOVE ? 0 : op.value);
+        }
+    }
+    return true;
+}
+
+// seq는 mutation이 key의 stripe를 잡고 있는 동안 받은 것이다. (ChangeOrder) ring에 넣는 것은 stripe를 놓은 뒤이므로
+// ring 안의 순서는 seq 순서와 조금 다를 수 있다. table 안에서 도는 thread는 가득 차도 기다리지 않는다.
+void SO_Hashtable::record_change(uint64_t seq, ChangeType type, unsigned long key, unsigned long value, uint32_t expire_at)
+{
+    ChangeEvent event{};
+    event.seq = seq;
+    event.key = key;
+    event.value = value;
+    if (expire_at != 0)
+        event.ttl_ms = max<int32_t>((int32_t)(expire_at - ttl_clock_ms()), 1);
+    event.type = type;
+    auto ring = this->change_rings[current_node() % this->change_rings.size()];
+    if (this->change_feed_block && is_internal_thread())
+    {
+        ring->push_overflow(event);
+        return;
+    }
+    while (false == ring->try_push(event))
+    {
+        if (false == this->change_feed_block)
+        {
+            ring->dropped.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        this_thread::yield();
+    }
+}
+
+size_t SO_Hashtable::poll_changes(unsigned node, vector<ChangeEvent> &out, size_t max_batch)
+{
+    if (node >= this->change_rings.size())
+        throw invalid_argument("the change feed is off or node is out of the max_nodes range");
+    return this->change_rings[node]->pop(out, max_batch);
+}
+
+uint64_t SO_Hashtable::dropped_changes(unsigned node) const
+{
+    if (node >= this->change_rings.size())
+        throw invalid_argument("the change feed is off or node is out of the max_nodes range");
+    return this->change_rings[node]->dropped.load(memory_order_relaxed);
+}
+
+// erase_if/cache sweep에서 split-ordered key 공간을 나눌 구간 수 (2^shift). 각 구간의 시작 bucket이 이미 있어야 하므로
+// 현재 bucket 수를 넘지 않는다.
+unsigned SO_Hashtable::sweep_shift() const
+{
+    const unsigned node_num = this->ready_replicas().size();
+    const uintptr_t bucket_num = this->bucket_nums[this->fallback_replica.load(memory_order_acquire)]->load(memory_order_relaxed);
+    unsigned shift = 0;
+    while ((1ul << shift) < node_num * SWEEP_RANGES_PER_NODE && (1ul << (shift + 1)) <= bucket_num)
+    {
+        ++shift;
+    }
+    return shift;
+}
+
+// split-ordered key 공간을 2^shift 개의 구간으로 나눴을 때 range번째 구간을 sweep.
+// 구간의 시작은 bucket reverse_bits(range << (64 - shift))의 dummy node이다. on_mark는 LFSET::EraseIf와 같다.
+size_t SO_Hashtable::sweep_range(unsigned node, unsigned shift, unsigned long range, const function<bool(const LFNODE &)> &pred,
+                                 const function<void(const LFNODE &, bool)> &on_mark)
+{
+    // partial replication에서는 구간 시작 bucket이 복제되지 않았을 수 있으므로 home replica를 쓴다.
+    auto bucket_arr = this->partial_replication ? this->bucket_array[this->fallback_replica.load(memory_order_relaxed)] : this->bucket_array[node];
+    const unsigned long range_num = 1ul << shift;
+    const unsigned long first_key = shift == 0 ? 0 : range << (width<unsigned long>() - shift);
+    const unsigned long last_key = range + 1 == range_num ? ULONG_MAX : ((range + 1) << (width<unsigned long>() - shift)) - 1;
+    const uintptr_t bucket = reverse_bits(first_key);
+    auto bucket_node = bucket_arr->get_bucket(bucket);
+    if (bucket_node == nullptr)
+    {
+        bucket_node = this->init_bucket(bucket_arr, bucket);
+    }
+    if (this->change_rings.empty())
+        return this->item_set.EraseIf(*bucket_node, last_key, pred, on_mark);
+    // insert/remove와 마찬가지로 mark 하는 동안 key의 stripe를 잡고 그 안에서 seq를 받는다.
+    // 이 함수는 sweeper나 local helper에서만 불리므로 record_change는 기다리지 않는다.
+    // 만료된 item은 consumer가 insert event의 ttl_ms로 지우므로 기록하지 않는다.
+    auto locks = this->change_locks.get();
+    auto locking_pred = [locks, &pred](const LFNODE &item) {
+        if (false == pred(item))
+            return false;
+        locks->lock(locks->stripe(item.key));
+        return true;
+    };
+    return this->item_set.EraseIf(*bucket_node, last_key, locking_pred, [this, locks, &on_mark](const LFNODE &item, bool marked) {
+        SO_PERTURB();
+        if (marked && item.kind == NODE_PLAIN && false == is_expired(item))
+            this->record_change(this->change_seq.fetch_add(1, memory_order_relaxed) + 1, ChangeType::REMOVE,
+                                reverse_bits(item.key) & ~KEY_MASK, 0);
+        locks->unlock(locks->stripe(item.key));
+        if (on_mark)
+            on_mark(item, marked);
+    });
+}
+
+// node의 replica로 first번째부터 stride 간격으로 구간을 맡아 sweep.
+size_t SO_Hashtable::sweep_ranges(unsigned node, unsigned first, unsigned stride, unsigned shift, const function<bool(const LFNODE &)> &pred)
+{
+    size_t erased = 0;
+    for (unsigned long p = first; p < (1ul << shift); p += stride)
+    {
+        erased += this->sweep_range(node, shift, p, pred);
+    }
+    return erased;
+}
+
+// node의 local helper가 주기적으로 호출한다. 자기 node가 맡은 구간에서 만료된 item을 지우고,
+// memory budget을 넘었으면 넘은 만큼의 (ready replica 수로 나눈) 몫을 CLOCK second chance로 evict 한다.
+void SO_Hashtable::sweep_cache(unsigned node)
+{
+    const size_t used = this->used_bytes.load(memory_order_relaxed);
+    const bool over_budget = this->memory_budget != 0 && used > this->memory_budget &&
+                             this->helper_scans.load(memory_order_acquire) >= this->evict_after[node];
+    if (false == over_budget && false == this->has_expiry.load(memory_order_relaxed))
+        return;
+    // 구간은 ready replica들이 나눠 맡는다. 채우는 중인 replica는 아직 맡지 않는다.
+    const auto ready = this->ready_replicas();
+    const auto pos = std::find(ready.begin(), ready.end(), node);
+    if (pos == ready.end())
+        return;
+    const unsigned long first = pos - ready.begin();
+    const unsigned long node_num = ready.size();
+
+    const size_t quota = over_budget ? (used - this->memory_budget) / node_num + 1 : 0;
+    size_t evicted = 0;
+    // EraseIf는 pred가 true이면 바로 mark를 시도하고 on_mark를 부르므로 evicting은 그 노드에 대한 판정이다.
+    // 다른 thread가 먼저 지운 노드는 이 sweep이 줄인 메모리가 아니므로 mark에 성공한 노드만 센다.
+    bool evicting = false;
+    auto pred = [quota, &evicted, &evicting](const LFNODE &item) {
+        evicting = false;
+        if ((item.key & 0x1) == 0)
+            return false;
+        if (is_expired(item))
+            return true;
+        if (evicted >= quota)
+            return false;
+        if (item.referenced.load(memory_order_relaxed) != 0)
+        {
+            item.referenced.store(0, memory_order_relaxed);
+            return false;
+        }
+        evicting = true;
+        return true;
+    };
+    auto on_mark = [&evicted, &evicting](const LFNODE &item, bool marked) {
+        if (evicting && marked)
+            evicted += node_footprint(item);
+    };
+
+    // 지난번에 멈춘 구간부터 시작해서 모든 구간을 한바퀴 돈다. 만료 검사 때문에 quota를 채워도 끝까지 돈다.
+    const unsigned shift = sweep_shift();
+    const unsigned long owned = ((1ul << shift) + node_num - 1 - first) / node_num;
+    if (owned == 0)
+        return;
+    auto &hand = this->clock_hands[node];
+    bool hand_moved = false;
+    for (unsigned long k = 0; k < owned; ++k)
+    {
+        auto idx = (hand + k) % owned;
+        this->sweep_range(node, shift, first + idx * node_num, pred, on_mark);
+        if (false == hand_moved && over_budget && evicted >= quota)
+        {
+            hand = (idx + 1) % owned;
+            hand_moved = true;
+        }
+    }
+    if (evicted == 0)
+        return;
+    // 다음 scan 전까지도 memory_used()가 맞도록 evict 한 만큼 바로 뺀다.
+    auto current = this->used_bytes.load(memory_order_relaxed);
+    while (false == this->used_bytes.compare_exchange_weak(current, current > evicted ? current - evicted : 0, memory_order_relaxed))
+    {
+    }
+    // 지금 진행 중인 scan은 evict 전의 노드를 셌을 수 있으므로 그 다음 scan이 끝난 뒤에 다시 evict 한다.
+    this->evict_after[node] = this->helper_scans.load(memory_order_acquire) + 2;
+}
+
+size_t SO_Hashtable::erase_if(const function<bool(unsigned long, unsigned long)> &pred)
+{
+    if (nr_engine)
+        return nr_engine->erase_if(pred);
+    if (shm_engine)
+        return shm_engine->erase_if(pred);
+    return this->erase_nodes([&pred](const LFNODE &node) {
+        return node.kind == NODE_PLAIN && pred(reverse_bits(node.key) & ~KEY_MASK, node.value);
+    });
+}
+
+size_t SO_Hashtable::erase_nodes(const function<bool(const LFNODE &)> &pred)
+{
+    // 도중에 replica가 retire 되어도 bucket array는 남아 있으므로 시작할 때의 ready replica들로 나눠 sweep 한다.
+    const auto ready = this->ready_replicas();
+    const unsigned node_num = ready.size();
+    const unsigned shift = sweep_shift();
+
+    auto node_pred = [&pred](const LFNODE &node) {
+        // dummy node(짝수 key)는 bucket의 시작점이므로 절대 지우지 않는다.
+        return (node.key & 0x1) != 0 && pred(node);
+    };
+
+    vector<size_t> erased(node_num, 0);
+    vector<thread> sweepers;
+    for (unsigned i = 0; i < node_num; ++i)
+    {
+        sweepers.emplace_back([this, i, node = ready[i], node_num, shift, &node_pred, &erased] {
+            mark_internal_thread();
+            set_current_node(node);
+            run_on_node(node);
+            erased[i] = this->sweep_ranges(node, i, node_num, shift, node_pred);
+        });
+    }
+    for (auto &sweeper : sweepers)
+    {
+        sweeper.join();
+    }
+
+    size_t total = 0;
+    for (auto n : erased)
+    {
+        total += n;
+    }
+    return total;
+}
+
+// dummy node들은 모든 node의 bucket array가 가리키고 있어서 list 전체를 한번에 떼어낼 수는 없다.
+// 대신 regular node만 병렬로 mark/unlink 하고, 해제는 global helper가 batch 단위로 한다.
+void SO_Hashtable::clear()
+{
+    if (nr_engine || shm_engine)
+    {
+        this->erase_if([](unsigned long, unsigned long) { return true; });
+        return;
+    }
+    this->erase_nodes([](const LFNODE &) { return true; });
+}
+
+size_t SO_Hashtable::check_replicas()
+{
+    if (nr_engine)
+        return nr_engine->check_replicas();
+    if (shm_engine)
+        return shm_engine->check_replicas();
+    size_t mismatch = 0;
+    // bucket 수도 table 전체의 값과 같아야 한다.
+    for (auto node : this->ready_replicas())
+    {
+        if (this->bucket_nums[node]->load(memory_order_relaxed) != this->growth.bucket_num.load(memory_order_acquire))
+            ++mismatch;
+    }
+    start_op();
+    for (LFNODE *curr = this->item_set.get_head().GetNext(); curr != nullptr; curr = curr->GetNext())
+    {
+        if ((curr->key & 0x1) != 0)
+            continue;
+        auto bucket = reverse_bits(curr->key);
+        for (auto node : this->ready_replicas())
+        {
+            auto bucket_arr = this->bucket_array[node];
+            // partial replication에서는 복제한 segment만 검사한다.
+            if (this->partial_replication && node != this->fallback_replica.load(memory_order_relaxed) &&
+                bucket_arr->segments[bucket / SEGMENT_SIZE].load(memory_order_acquire) == nullptr)
+                continue;
+            if (bucket_arr->get_bucket(bucket) != curr)
+                ++mismatch;
+        }
+    }
+    end_op();
+    return mismatch;
+}
+
+// item이 size개일 때 load factor를 넘지 않는 bucket 수. 한번에 여러 배 커질 수 있다.
+static uintptr_t target_bucket_num(uintptr_t size, uintptr_t bucket_num)
+{
+    while (size / bucket_num >= LOAD_FACTOR && bucket_num < MAX_BUCKET_NUM)
+        bucket_num *= 2;
+    return bucket_num;
+}
+
+// bucket 수는 줄어들지 않는다.
+static void raise_bucket_num(atomic_uintptr_t *bucket_num, uintptr_t target)
+{
+    auto old = bucket_num->load(memory_order_relaxed);
+    while (old < target && false == bucket_num->compare_exchange_weak(old, target, memory_order_relaxed))
+    {
+    }
+}
+
+// REPLICA_ABSENT인 node에는 보내지 않는다. node의 queue에 넣을 때마다 counts[i].sent를 늘린다.
+// bucket 수는 scan이 끝날 때 여기서만 정하고 모든 replica에 바로 쓰므로 node마다 다른 값을 쓰는 기간이 짧다.
+void global_helper_thread_func(LFSET *set, std::vector<SPSCQueue<BucketNotification> *> *queues, std::vector<atomic_uintptr_t *> *bucket_nums,
+                               BucketGrowth *growth, const atomic_int *states, NotificationCount *counts, atomic_ullong *scans,
+                               atomic_size_t *used_bytes, atomic_bool *stop, atomic_int *tid_slot)
+{
+    tid_slot->store(current_tid(), memory_order_release);
+    // global helper는 모든 node에서 실행될 수 있지만 remote access 계산에서는 0번 node에 있는 것으로 취급한다.
+    set_current_node(0);
+    run_on_nodes(queues->size());
+    uintptr_t last_size = 0;
+    while (false == stop->load(memory_order_relaxed))
     {
         uintptr_t size = 0;
+        size_t bytes = 0;
         start_op();
         LFNODE *prev = &set->get_head();
         LFNODE *curr = prev->GetNext();
@@ -193,120 +685,428 @@ void global_helper_thread_func(LFSET *set, std::vector<SPSCQueue<BucketNotificat
             {
                 if (curr->is_new)
                 {
+                    SO_PERTURB();
                     curr->is_new = false;
                     uintptr_t idx = reverse_bits(curr->key);
-                    for (auto &queue : *queues)
+                    for (unsigned i = 0; i < queues->size(); ++i)
                     {
-                        queue->emplace(idx, curr);
+                        if (states[i].load(memory_order_acquire) == REPLICA_ABSENT)
+                            continue;
+                        remote_access(i);
+                        (*queues)[i]->emplace(idx, curr);
+                        counts[i].sent.fetch_add(1, memory_order_release);
                     }
                 }
             } else if (!curr->IsMarked()) {
                 size += 1;
+                bytes += node_footprint(*curr);
             }
             prev = curr;
             curr = curr->GetNext();
         }
-        for(auto &queue : *queues) {
-            queue->emplace(size, nullptr);
+        // 크기가 바뀌지 않았으면 보내지 않는다. 매 scan마다 보내면 local helper가 따라가지 못해 queue가 끝없이 커진다.
+        if (size != last_size)
+        {
+            last_size = size;
+            const auto bucket_num = growth->bucket_num.load(memory_order_relaxed);
+            const auto target = target_bucket_num(size, bucket_num);
+            if (target != bucket_num)
+            {
+                // add_replica는 FILLING으로 바꾼 뒤 growth를 읽으므로, 여기서 ABSENT로 본 node도 새 값을 쓴다.
+                growth->bucket_num.store(target, memory_order_seq_cst);
+                for (unsigned i = 0; i < queues->size(); ++i)
+                {
+                    if (states[i].load(memory_order_seq_cst) == REPLICA_ABSENT)
+                        continue;
+                    remote_access(i);
+                    raise_bucket_num((*bucket_nums)[i], target);
+                }
+                growth->version.fetch_add(1, memory_order_release);
+            }
+            for (unsigned i = 0; i < queues->size(); ++i)
+            {
+                if (states[i].load(memory_order_acquire) == REPLICA_ABSENT)
+                    continue;
+                remote_access(i);
+                (*queues)[i]->emplace(size, nullptr);
+                counts[i].sent.fetch_add(1, memory_order_release);
+            }
         }
+        used_bytes->store(bytes, memory_order_relaxed);
         end_op();
+        scans->fetch_add(1, memory_order_release);
+        reclaim_bulk();
+        if (take_slow_op_dump_request())
+            dump_slow_ops(stderr);
         //std::this_thread::sleep_for(1ms);
     }
 }
 
-void local_helper_thread_fun(unsigned numa_idx, SPSCQueue<BucketNotification> *queue, BucketArray *bucket_arr, atomic_uintptr_t *bucket_num, atomic_uintptr_t *item_num)
+// fill이 있으면 node에 bind 한 뒤 먼저 실행해서 replica를 채운다. partial이면 복제한 segment의 bucket만 반영한다.
+void local_helper_thread_fun(unsigned numa_idx, SPSCQueue<BucketNotification> *queue, BucketArray *bucket_arr, atomic_uintptr_t *item_num,
+                             NotificationCount *count, bool partial, function<void()> fill, function<void()> sweep_cache, atomic_bool *stop, atomic_int *tid_slot)
 {
-    if (-1 == numa_run_on_node(numa_idx))
+    tid_slot->store(current_tid(), memory_order_release);
+    mark_internal_thread();
+    set_current_node(numa_idx);
+    if (false == run_on_node(numa_idx))
     {
         fprintf(stderr, "Can't bind local helper thread to node #%d\n", numa_idx);
         exit(-1);
     }
-    while (true)
+    if (fill)
+        fill();
+    auto next_sweep = chrono::steady_clock::now() + CACHE_SWEEP_INTERVAL;
+    while (false == stop->load(memory_order_relaxed))
     {
+        auto now = chrono::steady_clock::now();
+        if (now >= next_sweep)
+        {
+            sweep_cache();
+            next_sweep = now + CACHE_SWEEP_INTERVAL;
+        }
         auto bucket_noti = queue->deq();
         if (!bucket_noti)
         {
             //std::this_thread::sleep_for(1ms);
             continue;
         }
+        SO_PERTURB();
 
         if (bucket_noti->node == nullptr)
         {
-            auto new_item_num = bucket_noti->org_key;
-            item_num->store(new_item_num, memory_order_relaxed);
-            const auto old_bucket_num = bucket_num->load(memory_order_relaxed);
-            if (new_item_num / old_bucket_num >= LOAD_FACTOR) {
-                bucket_num->store(old_bucket_num * 2);
-            }
+            item_num->store(bucket_noti->org_key, memory_order_relaxed);
         }
         else if ((bucket_noti->org_key & KEY_MASK) == 0)
         {
-            bucket_arr->set_bucket(bucket_noti->org_key, bucket_noti->node);
+            if (partial)
+                bucket_arr->set_bucket_if_present(bucket_noti->org_key, bucket_noti->node);
+            else
+                bucket_arr->set_bucket(bucket_noti->org_key, bucket_noti->node);
         }
+        count->applied.fetch_add(1, memory_order_release);
     }
 }
 
-SO_Hashtable::SO_Hashtable(unsigned node_num)
+SO_Hashtable::SO_Hashtable(unsigned node_num, Engine engine) : SO_Hashtable(node_num, SO_Options{engine})
+{
+}
+
+SO_Hashtable::SO_Hashtable(unsigned node_num, const SO_Options &options)
 {
+    if (options.engine != Engine::SPLIT_ORDERED && options.memory_budget != 0)
+        throw invalid_argument("memory budget is only supported by the split-ordered engine");
+    if (options.engine != Engine::SPLIT_ORDERED && options.partial_replication)
+        throw invalid_argument("partial replication is only supported by the split-ordered engine");
+    if (options.engine != Engine::SPLIT_ORDERED && options.slow_op_threshold.count() != 0)
+        throw invalid_argument("the slow operation recorder is only supported by the split-ordered engine");
+    if (options.engine != Engine::SPLIT_ORDERED && options.change_feed_capacity != 0)
+        throw invalid_argument("the change feed is only supported by the split-ordered engine");
+    if (options.engine == Engine::NODE_REPLICATED)
+    {
+        if (options.delegation_owners_per_node != 0)
+            throw invalid_argument("delegation is only supported by the split-ordered engine");
+        // list와 helper thread는 만들지 않는다.
+        nr_engine = make_unique<NR_Hashtable>(node_num);
+        return;
+    }
+    if (options.engine == Engine::SHARED_MEMORY)
+    {
+        if (options.delegation_owners_per_node != 0)
+            throw invalid_argument("delegation is only supported by the split-ordered engine");
+        if (options.shm_name.empty())
+            throw invalid_argument("the shared memory engine needs a region name");
+        // helper thread는 process마다 따로 생기므로 두지 않는다. bucket은 각 node의 thread가 처음 쓸 때 채운다.
+        shm_engine = make_unique<ShmHashtable>(options.shm_name, node_num, options.shm_node_bytes, options.shm_max_buckets);
+        return;
+    }
+
+    const unsigned max_nodes = max(node_num, options.max_nodes);
+#ifdef SO_COMPACT_REFS
+    this->dummy_arena = make_unique<DummyArena>();
+    LFNODE *first_bucket = this->dummy_arena->alloc(0);
+#else
     LFNODE *first_bucket = new LFNODE{0, 0};
+#endif
     first_bucket->is_new = false;
     item_set.Add(item_set.get_head(), *first_bucket);
-    for (auto i = 0; i < node_num; ++i)
+    bucket_array.assign(max_nodes, nullptr);
+    msg_queues.assign(max_nodes, nullptr);
+    bucket_nums.assign(max_nodes, nullptr);
+    item_nums.assign(max_nodes, nullptr);
+    partial_replication = options.partial_replication;
+    if (partial_replication)
+        access_counts.assign(max_nodes, nullptr);
+    refreshing_segments.resize(max_nodes);
+    next_rebalance.assign(max_nodes, chrono::steady_clock::now());
+    replica_state = make_unique<atomic_int[]>(max_nodes);
+    noti_counts = make_unique<NotificationCount[]>(max_nodes);
+    helper_stops = make_unique<atomic_bool[]>(max_nodes);
+    for (unsigned i = 0; i < max_nodes; ++i)
     {
-        bucket_array.push_back(NUMA_alloc<BucketArray>(i, first_bucket));
-        msg_queues.push_back(NUMA_alloc<SPSCQueue<BucketNotification>>(i));
-        bucket_nums.push_back(NUMA_alloc<atomic_uintptr_t>(i, 2));
-        item_nums.push_back(NUMA_alloc<atomic_uintptr_t>(i, 0));
+        replica_state[i].store(REPLICA_ABSENT, memory_order_relaxed);
+        helper_stops[i].store(false, memory_order_relaxed);
     }
-
-    auto node_mask = numa_allocate_nodemask();
-    for (auto i=0; i<node_num; ++i) {
-        node_mask = numa_bitmask_setbit(node_mask, i);
+    for (unsigned i = 0; i < node_num; ++i)
+    {
+        alloc_replica(i, first_bucket);
+        replica_state[i].store(REPLICA_READY, memory_order_relaxed);
     }
 
-    this->global_helper = std::thread{global_helper_thread_func, &this->item_set, &this->msg_queues, node_mask};
-    for (auto i = 0; i < node_num; ++i)
+    this->memory_budget = options.memory_budget;
+    this->slow_op_ns.store(options.slow_op_threshold.count(), memory_order_relaxed);
+    // 나중에 add 할 node의 thread도 기록할 수 있도록 max_nodes개를 모두 만든다.
+    if (options.change_feed_capacity != 0)
     {
-        this->local_helpers.emplace_back(local_helper_thread_fun, i, this->msg_queues[i], bucket_array[i], bucket_nums[i], item_nums[i]);
+        for (unsigned i = 0; i < max_nodes; ++i)
+            this->change_rings.push_back(NUMA_alloc<ChangeRing>(i, i, options.change_feed_capacity));
+        this->change_locks = make_unique<KeyLocks>();
     }
+    this->change_feed_block = options.change_feed_block;
+    this->clock_hands.assign(max_nodes, 0);
+    this->evict_after.assign(max_nodes, 0);
+    this->helper_tid = std::vector<atomic_int>(max_nodes + 1);
+    this->local_helpers.resize(max_nodes);
+    this->global_helper = std::thread{global_helper_thread_func, &this->item_set, &this->msg_queues, &this->bucket_nums, &this->growth,
+                                      this->replica_state.get(), this->noti_counts.get(), &this->helper_scans, &this->used_bytes, &this->stop_helpers, &this->helper_tid[0]};
+    for (unsigned i = 0; i < node_num; ++i)
+    {
+        start_local_helper(i, false);
+    }
+    if (options.delegation_owners_per_node != 0)
+        this->delegation = make_unique<Delegation>(this, node_num, options.delegation_owners_per_node);
 }
 
-BucketArray::BucketArray(LFNODE *first_bucket)
+BucketArray::BucketArray(LFNODE *first_bucket, const DummyArena *arena) : arena{arena}
 {
-    auto first_arr = new array<LFNODE *, SEGMENT_SIZE>;
-    (*first_arr)[0] = first_bucket;
+    auto first_arr = new Segments<BucketRef>{};
+    (*first_arr)[0] = ref_of(first_bucket);
     segments[0].store(first_arr, memory_order_relaxed);
 }
 
 SO_Hashtable::~SO_Hashtable()
 {
-    global_helper.~thread();
+    delegation.reset();
+    stop_helpers.store(true, memory_order_relaxed);
+    for (unsigned i = 0; i < local_helpers.size(); ++i)
+    {
+        helper_stops[i].store(true, memory_order_relaxed);
+    }
+    if (global_helper.joinable())
+        global_helper.join();
     for(auto& helper : local_helpers) {
-        helper.~thread();
+        if (helper.joinable())
+            helper.join();
     }
-    for (auto i = 0; i < NUMA_NODE_NUM; ++i)
+    for (auto i = 0; i < bucket_array.size(); ++i)
     {
+        if (bucket_array[i] == nullptr)
+            continue;
         NUMA_dealloc(bucket_array[i]);
         NUMA_dealloc(bucket_nums[i]);
+        NUMA_dealloc(item_nums[i]);
         NUMA_dealloc(msg_queues[i]);
+        if (partial_replication)
+            NUMA_dealloc(access_counts[i]);
+    }
+    for (auto ring : change_rings)
+    {
+        NUMA_dealloc(ring);
+    }
+}
+
+void SO_Hashtable::alloc_replica(unsigned node, LFNODE *first_bucket)
+{
+    bucket_array[node] = NUMA_alloc<BucketArray>(node, first_bucket, dummy_arena.get());
+    msg_queues[node] = NUMA_alloc<SPSCQueue<BucketNotification>>(node);
+    bucket_nums[node] = NUMA_alloc<atomic_uintptr_t>(node, 2);
+    item_nums[node] = NUMA_alloc<atomic_uintptr_t>(node, 0);
+    if (partial_replication)
+        access_counts[node] = NUMA_alloc<SegmentCounters>(node);
+}
+
+void SO_Hashtable::start_local_helper(unsigned node, bool fill)
+{
+    // home replica는 partial replication에서도 모든 segment를 갖는다.
+    const bool partial = this->partial_replication && node != this->fallback_replica.load(memory_order_relaxed);
+    auto sweep = [this, node, partial] {
+        this->sweep_cache(node);
+        auto now = chrono::steady_clock::now();
+        if (partial && now >= this->next_rebalance[node])
+        {
+            this->rebalance_segments(node);
+            this->next_rebalance[node] = now + REPLICATION_INTERVAL;
+        }
+    };
+    function<void()> fill_fn;
+    if (fill)
+        fill_fn = [this, node] { this->fill_replica(node); };
+    this->local_helpers[node] = std::thread{local_helper_thread_fun, node, this->msg_queues[node], this->bucket_array[node], this->item_nums[node],
+                                            &this->noti_counts[node], partial, fill_fn, sweep, &this->helper_stops[node], &this->helper_tid[node + 1]};
+}
+
+// node의 local helper에서 실행한다. REPLICA_FILLING이 된 뒤로 생긴 dummy node는 이 node의 queue로도 오므로,
+// 그 전에 만들어진 dummy node를 source replica에서 복사하면 빠진 bucket이 없다.
+// partial replication에서는 복사하지 않고 자주 쓰는 segment만 local helper가 나중에 복제한다.
+void SO_Hashtable::fill_replica(unsigned node)
+{
+    const auto source = this->fallback_replica.load(memory_order_acquire);
+    if (this->partial_replication)
+    {
+        this->replica_state[node].store(REPLICA_READY, memory_order_release);
+        return;
+    }
+    auto &stop = this->helper_stops[node];
+    // FILLING으로 바뀌기 전에 state를 읽었을 수 있는 scan이 모두 끝날 때까지 기다린다.
+    const auto scans = this->helper_scans.load(memory_order_acquire);
+    while (this->helper_scans.load(memory_order_acquire) < scans + 2)
+    {
+        if (stop.load(memory_order_relaxed))
+            return;
+        this_thread::yield();
+    }
+    // 그 scan들이 source에 보낸 notification을 source의 local helper가 모두 반영할 때까지 기다린다.
+    const auto sent = this->noti_counts[source].sent.load(memory_order_acquire);
+    while (this->noti_counts[source].applied.load(memory_order_acquire) < sent)
+    {
+        if (stop.load(memory_order_relaxed))
+            return;
+        this_thread::yield();
+    }
+
+    auto from = this->bucket_array[source];
+    auto to = this->bucket_array[node];
+    for (uintptr_t seg = 0; seg < SEGMENT_SIZE; ++seg)
+    {
+        auto seg_ptr = from->segments[seg].load(memory_order_acquire);
+        if (seg_ptr == nullptr)
+            continue;
+        for (uintptr_t i = 0; i < SEGMENT_SIZE; ++i)
+        {
+            remote_access(source);
+            auto bucket_ref = (*seg_ptr)[i];
+            if (bucket_ref != NO_BUCKET && to->get_bucket(seg * SEGMENT_SIZE + i) == nullptr)
+                to->set_bucket(seg * SEGMENT_SIZE + i, from->node_of(bucket_ref));
+        }
     }
+    this->item_nums[node]->store(this->item_nums[source]->load(memory_order_relaxed), memory_order_relaxed);
+    this->replica_state[node].store(REPLICA_READY, memory_order_release);
 }
 
-BucketArray* SO_Hashtable::get_bucket_array() {
-   static thread_local BucketArray* local_bucket = this->bucket_array[numa_id];
-   return local_bucket;
+void SO_Hashtable::add_replica(unsigned node)
+{
+    if (nr_engine || shm_engine)
+        throw runtime_error("elastic replicas are only supported by the split-ordered engine");
+    if (node >= this->bucket_array.size())
+        throw invalid_argument("node is out of the max_nodes range");
+    lock_guard<mutex> guard{this->replica_lock};
+    if (this->replica_state[node].load(memory_order_relaxed) != REPLICA_ABSENT)
+        return;
+    if (this->bucket_array[node] == nullptr)
+        alloc_replica(node, this->bucket_array[this->fallback_replica.load(memory_order_relaxed)]->get_bucket(0));
+    this->helper_stops[node].store(false, memory_order_relaxed);
+    this->replica_state[node].store(REPLICA_FILLING, memory_order_seq_cst);
+    // 이 뒤로 bucket 수가 바뀌면 global helper가 이 replica에도 쓴다.
+    raise_bucket_num(this->bucket_nums[node], this->growth.bucket_num.load(memory_order_seq_cst));
+    start_local_helper(node, true);
+}
+
+void SO_Hashtable::retire_replica(unsigned node)
+{
+    if (nr_engine || shm_engine)
+        throw runtime_error("elastic replicas are only supported by the split-ordered engine");
+    if (node >= this->bucket_array.size())
+        throw invalid_argument("node is out of the max_nodes range");
+    lock_guard<mutex> guard{this->replica_lock};
+    if (this->replica_state[node].load(memory_order_relaxed) == REPLICA_ABSENT)
+        return;
+    // 채우는 중인 replica는 fallback replica를 source로 쓰고 있으므로 다 채워질 때까지 retire 하지 않는다.
+    for (unsigned i = 0; i < this->bucket_array.size(); ++i)
+    {
+        if (this->replica_state[i].load(memory_order_acquire) == REPLICA_FILLING)
+            throw runtime_error("can't retire a replica while a replica is being filled");
+    }
+    if (this->partial_replication && this->fallback_replica.load(memory_order_relaxed) == node)
+        throw runtime_error("can't retire the home replica of partial replication");
+    auto ready = this->ready_replicas();
+    if (ready.size() == 1)
+        throw runtime_error("can't retire the last replica");
+
+    this->replica_state[node].store(REPLICA_ABSENT, memory_order_seq_cst);
+    if (this->fallback_replica.load(memory_order_relaxed) == node)
+        this->fallback_replica.store(ready[0] != node ? ready[0] : ready[1], memory_order_release);
+    this->helper_stops[node].store(true, memory_order_relaxed);
+    this->local_helpers[node].join();
+    this->helper_tid[node + 1].store(0, memory_order_relaxed);
+}
+
+bool SO_Hashtable::replica_ready(unsigned node) const
+{
+    if (nr_engine || shm_engine)
+        return true;
+    return node < this->bucket_array.size() && this->replica_state[node].load(memory_order_acquire) == REPLICA_READY;
+}
+
+size_t SO_Hashtable::replica_segments(unsigned node) const
+{
+    if (node >= this->bucket_array.size() || this->bucket_array[node] == nullptr)
+        return 0;
+    return this->bucket_array[node]->segment_num();
+}
+
+vector<unsigned> SO_Hashtable::ready_replicas() const
+{
+    vector<unsigned> ready;
+    for (unsigned i = 0; i < this->bucket_array.size(); ++i)
+    {
+        if (this->replica_state[i].load(memory_order_acquire) == REPLICA_READY)
+            ready.push_back(i);
+    }
+    return ready;
+}
+
+vector<pid_t> SO_Hashtable::helper_tids() const
+{
+    vector<pid_t> tids;
+    for (unsigned i = 0; i < this->helper_tid.size(); ++i)
+    {
+        auto &tid = this->helper_tid[i];
+        if (i != 0 && this->replica_state[i - 1].load(memory_order_acquire) == REPLICA_ABSENT)
+            continue;
+        while (tid.load(memory_order_acquire) == 0)
+        {
+            this_thread::yield();
+        }
+        tids.push_back(tid.load(memory_order_relaxed));
+    }
+    if (delegation)
+    {
+        auto owners = delegation->owner_tids();
+        tids.insert(tids.end(), owners.begin(), owners.end());
+    }
+    return tids;
+}
+
+// 자기 node의 replica가 ready가 아니면 fallback replica를 쓴다.
+unsigned SO_Hashtable::replica_index() const
+{
+    const unsigned node = current_node() % this->bucket_array.size();
+    if (this->replica_state[node].load(memory_order_acquire) == REPLICA_READY)
+        return node;
+    return this->fallback_replica.load(memory_order_acquire);
 }
 
 atomic_uintptr_t* SO_Hashtable::get_bucket_num() {
-   static thread_local atomic_uintptr_t* local_bucket_num = this->bucket_nums[numa_id];
-   return local_bucket_num;
+   return this->bucket_nums[replica_index()];
 }
 
 void pin_thread()
 {
-    if (-1 == numa_run_on_node(numa_id))
+    if (false == run_on_node(current_node()))
     {
-        fprintf(stderr, "Can't bind thread #%d to node #%d\n", tid, numa_id);
+        fprintf(stderr, "Can't bind thread to node #%d\n", current_node());
         exit(-1);
     }
 }
+
+} // namespace so
@@ -3,24 +3,160 @@
 
 #include <array>
 #include <atomic>
+#include <chrono>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
 #include <vector>
+#include <functional>
 #include <numa.h>
 #include "lf_set.h"
+#include "flight_recorder.h"
+#include "change_feed.h"
+#include "dummy_arena.h"
 #include "SPSCQueue.h"
+#include "node_replicated.h"
+#include "delegation.h"
+#include "shm_table.h"
 
+namespace so
+{
+
+#ifdef SO_STRESS
+// stress test의 작은 table에서도 segment가 여러 개 생기고 자주 복제/제거되어 partial replication 경로를 타도록 한다.
+constexpr unsigned SEGMENT_SIZE = 256;
+constexpr unsigned ACCESS_SAMPLE_RATE = 4;
+#else
 constexpr unsigned SEGMENT_SIZE = 1024 * 1024;
+// partial replication: bucket 접근 ACCESS_SAMPLE_RATE번 중 한번만 segment의 counter를 올린다. (2의 거듭제곱)
+constexpr unsigned ACCESS_SAMPLE_RATE = 64;
+#endif
 constexpr unsigned LOAD_FACTOR = 1;
+#ifdef SO_COMPACT_REFS
+// bucket array replica는 dummy node를 32bit ref로 가리킨다. (dummy_arena.h)
+using BucketRef = uint32_t;
+// bucket array가 담을 수 있는 bucket 수. bucket 수는 이보다 커지지 않는다. ref로 가리킬 수 있는 dummy node 수도 넘지 않는다.
+constexpr uintptr_t MAX_BUCKET_NUM = std::min<uintptr_t>((uintptr_t)SEGMENT_SIZE * SEGMENT_SIZE, (uintptr_t)1 << 31);
+#else
+using BucketRef = LFNODE *;
+// bucket array가 담을 수 있는 bucket 수. bucket 수는 이보다 커지지 않는다.
+constexpr uintptr_t MAX_BUCKET_NUM = (uintptr_t)SEGMENT_SIZE * SEGMENT_SIZE;
+#endif
+constexpr BucketRef NO_BUCKET{};
+// erase_if에서 NUMA node 하나가 맡는 split-ordered key 구간의 수
+constexpr unsigned SWEEP_RANGES_PER_NODE = 4;
+// local helper가 만료/evict sweep을 하는 간격
+constexpr std::chrono::milliseconds CACHE_SWEEP_INTERVAL{10};
+// local helper가 REPLICATION_INTERVAL마다 counter를 보고, 그동안 SEGMENT_PROMOTE_SAMPLES번 이상 sample 된 segment는
+// 복제하고 SEGMENT_EVICT_SAMPLES번보다 적게 sample 된 복제본은 버린다.
+constexpr std::chrono::milliseconds REPLICATION_INTERVAL{100};
+constexpr unsigned SEGMENT_PROMOTE_SAMPLES = 8;
+constexpr unsigned SEGMENT_EVICT_SAMPLES = 1;
 
 template <typename T>
 using Segments = std::array<T, SEGMENT_SIZE>;
 
 struct BucketArray
 {
-    BucketArray(LFNODE *first_bucket);
-    std::array<std::atomic<Segments<LFNODE *> *>, SEGMENT_SIZE> segments;
-    LFNODE *get_bucket(uintptr_t bucket);
+    BucketArray(LFNODE *first_bucket, const DummyArena *arena);
+    std::array<std::atomic<Segments<BucketRef> *>, SEGMENT_SIZE> segments;
+    const DummyArena *arena; // SO_COMPACT_REFS에서 ref를 pointer로 바꿀 때만 사용
+    LFNODE *node_of(BucketRef ref) const
+    {
+#ifdef SO_COMPACT_REFS
+        return ref == NO_BUCKET ? nullptr : this->arena->node(ref);
+#else
+        return ref;
+#endif
+    }
+    // dummy node의 ref. SO_COMPACT_REFS에서 dummy node는 value에 자기 ref를 갖고 있다.
+    static BucketRef ref_of(LFNODE *node)
+    {
+#ifdef SO_COMPACT_REFS
+        return node == nullptr ? NO_BUCKET : (BucketRef)node->value;
+#else
+        return node;
+#endif
+    }
+    LFNODE *get_bucket(uintptr_t bucket)
+    {
+        auto seg_ptr = this->segments[bucket / SEGMENT_SIZE].load(std::memory_order_relaxed);
+        if (seg_ptr == nullptr)
+            return nullptr;
+        return node_of((*seg_ptr)[bucket % SEGMENT_SIZE]);
+    }
     void set_bucket(uintptr_t bucket, LFNODE *head);
+    // segment가 없으면 만들지 않고 무시한다. (partial replication에서 복제하지 않은 segment)
+    void set_bucket_if_present(uintptr_t bucket, LFNODE *head);
+    size_t segment_num() const;
+};
+
+// node가 segment마다 bucket에 접근한 횟수의 sample
+struct SegmentCounters
+{
+    std::array<std::atomic_uint, SEGMENT_SIZE> counts{};
+};
+
+class TraceRecorder;
+
+enum class Engine
+{
+    SPLIT_ORDERED,   // node마다 bucket array만 복제하고 item list는 공유
+    NODE_REPLICATED, // node마다 table 전체를 복제하고 update는 공유 log로 전파 (read 위주 workload용)
+    SHARED_MEMORY,   // 이름 있는 shared memory에 table을 두고 여러 process가 함께 사용
+};
+
+struct SO_Options
+{
+    Engine engine = Engine::SPLIT_ORDERED;
+    // 0이 아니면 node마다 이만큼 owner thread를 두고 insert/remove를 key의 owner에게 맡긴다. (split-ordered engine 전용)
+    unsigned delegation_owners_per_node = 0;
+    // Engine::SHARED_MEMORY의 region 이름 ("/name"). 같은 이름을 쓰는 process들은 같은 table을 본다.
+    std::string shm_name;
+    size_t shm_node_bytes = SHM_DEFAULT_NODE_BYTES;
+    // shared memory table의 bucket 수 상한 (2의 거듭제곱). node마다 이만큼의 bucket array를 region에 미리 잡는다.
+    unsigned long shm_max_buckets = SHM_DEFAULT_MAX_BUCKETS;
+    // 0이 아니면 item이 차지하는 메모리가 이 byte 수를 넘지 않도록 local helper가 CLOCK 방식으로 evict 한다.
+    // (split-ordered engine 전용)
+    size_t memory_budget = 0;
+    // add_replica로 replica를 둘 수 있는 node 수. 0이면 처음 node 수와 같다. (split-ordered engine 전용)
+    unsigned max_nodes = 0;
+    // true면 home replica만 bucket array 전체를 갖고, 다른 node는 자주 접근하는 segment만 복제한다.
+    // 복제하지 않은 segment의 bucket은 home replica에서 읽는다. home replica는 retire 할 수 없다. (split-ordered engine 전용)
+    bool partial_replication = false;
+    // 0이 아니면 이보다 오래 걸린 정수/byte string key의 insert/remove/find를 thread별 ring에 기록한다. (flight_recorder.h)
+    // (split-ordered engine 전용)
+    std::chrono::nanoseconds slow_op_threshold{0};
+    // 0이 아니면 성공한 정수 key의 insert/remove/multi_update와 erase_if/eviction이 지운 item을
+    // node마다 이 크기의 ring에 기록한다. poll_changes()로 읽는다. (split-ordered engine 전용)
+    size_t change_feed_capacity = 0;
+    // true면 ring이 가득 찼을 때 쓰는 thread가 consumer가 꺼낼 때까지 기다리고, false면 event를 버린다.
+    // helper/sweeper/delegation owner는 기다리지 않고 overflow list에 넣는다. consumer thread는 blocking 중에
+    // insert/remove를 직접 부르면 안 된다. (erase_if/clear는 괜찮다)
+    bool change_feed_block = true;
+};
+
+// node별 bucket array replica의 상태
+enum ReplicaState : int
+{
+    REPLICA_ABSENT,  // 쓰지 않음. 예전에 쓰던 bucket array가 남아 있을 수 있다.
+    REPLICA_FILLING, // global helper가 notification을 보내기 시작했고 local helper가 다른 replica에서 bucket을 복사하는 중
+    REPLICA_READY,   // node의 thread들이 사용
+};
+
+// global helper가 node에 보낸 notification 수와 local helper가 반영한 수
+struct NotificationCount
+{
+    alignas(64) std::atomic_ullong sent{0};
+    alignas(64) std::atomic_ullong applied{0};
+};
+
+// table 전체의 bucket 수. global helper만 바꾸고, 바꿀 때마다 모든 replica의 bucket_nums에 바로 반영한 뒤 version을 올린다.
+struct BucketGrowth
+{
+    alignas(64) std::atomic_uintptr_t bucket_num{2};
+    std::atomic_ullong version{0};
 };
 
 struct BucketNotification
@@ -32,28 +168,179 @@ struct BucketNotification
 class SO_Hashtable
 {
 public:
-    SO_Hashtable(unsigned node_num);
+    SO_Hashtable(unsigned node_num, Engine engine = Engine::SPLIT_ORDERED);
+    SO_Hashtable(unsigned node_num, const SO_Options &options);
     ~SO_Hashtable();
     bool remove(unsigned long key);
-    optional<unsigned long> find(unsigned long key);
+    std::optional<unsigned long> find(unsigned long key);
     bool insert(unsigned long key, unsigned long value);
+    // ttl이 지나면 find/insert/remove에서 없는 것으로 보이고 local helper가 지운다. (split-ordered engine 전용)
+    bool insert(unsigned long key, unsigned long value, std::chrono::milliseconds ttl);
+    // global helper가 마지막으로 list를 훑었을 때 item들이 차지한 메모리
+    size_t memory_used() const { return used_bytes.load(std::memory_order_relaxed); }
+    // byte string key/value. 정수 key와 같은 list에 있지만 서로 다른 item이다.
+    // split-ordered engine 전용이고 trace에는 기록되지 않으며, delegation 중에도 호출한 thread에서 바로 실행한다.
+    bool insert(std::string_view key, std::string_view value);
+    bool remove(std::string_view key);
+    std::optional<std::string> find(std::string_view key);
+    // 최대 MCAS_MAX_WORDS개의 서로 다른 정수 key에 대한 insert/remove/update를 원자적으로 적용한다.
+    // 모든 op의 조건(insert는 key가 없음, remove/update는 key가 있음)이 맞을 때만 적용하고 true를 반환.
+    // split-ordered engine 전용이고 trace에는 기록되지 않는다. 단일 key operation의 경로는 그대로다.
+    bool multi_update(const std::vector<MultiOp> &ops);
+    // pred(key, value)를 만족하는 정수 key item을 NUMA node마다 하나의 thread로 병렬 삭제. 삭제한 item 수 반환
+    // split-ordered engine에서 pred는 호출한 thread가 아닌 sweeper thread들에서 동시에 불리므로 thread-safe 해야 한다.
+    size_t erase_if(const std::function<bool(unsigned long, unsigned long)> &pred);
+    void clear();
+    // recorder가 설정되면 모든 insert/remove/find 호출을 trace로 기록한다. nullptr이면 기록하지 않음
+    void set_trace_recorder(TraceRecorder *recorder) { this->recorder = recorder; }
+    // SO_Options::slow_op_threshold를 실행 중에 바꾼다. 0이면 기록하지 않음
+    void set_slow_op_threshold(std::chrono::nanoseconds threshold) { slow_op_ns.store(threshold.count(), std::memory_order_relaxed); }
+    // list의 dummy node 중 어떤 replica에서 다른 노드를 가리키거나 아직 전파되지 않은 bucket의 수와
+    // bucket 수가 table 전체의 값과 다른 replica의 수 (테스트용)
+    size_t check_replicas();
+    // global helper, local helper들, delegation owner들 순서의 kernel thread id. 모든 helper가 시작할 때까지 기다린다.
+    std::vector<pid_t> helper_tids() const;
+    // node의 replica를 만들고 (예전에 쓰던 것이 있으면 재사용) local helper가 background에서 ready replica로부터 채운다.
+    // 다 채워질 때까지 node의 thread들은 다른 replica를 쓴다. 이미 있으면 아무것도 하지 않는다.
+    void add_replica(unsigned node);
+    // node의 replica를 쓰지 않고 local helper를 멈춘다. 그 node의 thread들은 다른 ready replica를 쓴다.
+    // 이미 replica를 읽은 thread가 있을 수 있으므로 bucket array는 해제하지 않고 다시 add 할 때 재사용한다.
+    void retire_replica(unsigned node);
+    bool replica_ready(unsigned node) const;
+    // node의 replica가 갖고 있는 bucket segment 수 (partial replication에서 메모리 사용량 확인용)
+    size_t replica_segments(unsigned node) const;
+    // node의 change feed에서 최대 max_batch개를 seq 순서에 가깝게 꺼내 out 뒤에 붙이고 꺼낸 수를 반환한다.
+    // node마다 한 thread만 호출해야 한다. 여러 node의 event를 합칠 때는 seq로 정렬한다.
+    // 같은 key의 event는 seq 순서가 실제로 일어난 순서와 같으므로 seq 순서로 적용하면 table과 같아진다.
+    size_t poll_changes(unsigned node, std::vector<ChangeEvent> &out, size_t max_batch);
+    // change_feed_block이 false일 때 ring이 가득 차서 버린 event 수
+    uint64_t dropped_changes(unsigned node) const;
+    // global helper가 정한 table 전체의 bucket 수와 그 값이 바뀐 횟수
+    uintptr_t bucket_count() const { return growth.bucket_num.load(std::memory_order_acquire); }
+    unsigned long long growth_version() const { return growth.version.load(std::memory_order_acquire); }
 
 private:
-    std::vector<atomic_uintptr_t*> bucket_nums;
-    std::vector<atomic_uintptr_t*> item_nums;
+    friend class Delegation;
+
+    std::vector<std::atomic_uintptr_t*> bucket_nums;
+    std::vector<std::atomic_uintptr_t*> item_nums;
+    std::unique_ptr<DummyArena> dummy_arena; // SO_COMPACT_REFS에서만 사용. item_set보다 나중에 해제되어야 한다.
     LFSET item_set;
     std::vector<BucketArray*> bucket_array;
     std::vector<SPSCQueue<BucketNotification>*> msg_queues;
+    TraceRecorder *recorder = nullptr;
+    std::atomic_uint64_t slow_op_ns{0};
+    std::vector<ChangeRing *> change_rings; // change feed를 켰을 때만 max_nodes개
+    bool change_feed_block = true;
+    std::atomic_uint64_t change_seq{0};
+    std::unique_ptr<KeyLocks> change_locks; // change feed를 켰을 때만 있다.
+    void record_change(uint64_t seq, ChangeType type, unsigned long key, unsigned long value, uint32_t expire_at = 0);
+    std::unique_ptr<NR_Hashtable> nr_engine; // Engine::NODE_REPLICATED일 때만 사용
+    std::unique_ptr<Delegation> delegation;
+    std::unique_ptr<ShmHashtable> shm_engine; // Engine::SHARED_MEMORY일 때만 사용
+
+    // delegation 여부와 상관없이 현재 thread에서 바로 실행
+    bool insert_local(unsigned long key, unsigned long value, uint32_t expire_at = 0);
+    bool remove_local(unsigned long key);
+
+    LFNODE *init_bucket(BucketArray *bucket_arr, uintptr_t bucket);
+    // 현재 thread의 replica에서 bucket의 dummy node를 찾고 없으면 만든다.
+    LFNODE *lookup_bucket(uintptr_t bucket);
+    LFNODE *lookup_partial(unsigned node, uintptr_t bucket);
+    void rebalance_segments(unsigned node);
+    LFNODE *get_bucket_node(unsigned long key, SlowOpProbe *probe = nullptr);
+    size_t erase_nodes(const std::function<bool(const LFNODE &)> &pred);
+    unsigned sweep_shift() const;
+    size_t sweep_range(unsigned node, unsigned shift, unsigned long range, const std::function<bool(const LFNODE &)> &pred,
+                       const std::function<void(const LFNODE &, bool)> &on_mark = {});
+    size_t sweep_ranges(unsigned node, unsigned first, unsigned stride, unsigned shift, const std::function<bool(const LFNODE &)> &pred);
+    void sweep_cache(unsigned node);
+
+    size_t memory_budget = 0;
+    std::atomic_size_t used_bytes{0};
+    std::atomic_bool has_expiry{false};
+    std::vector<unsigned long> clock_hands; // node마다 다음 eviction을 시작할 구간 (node의 몇 번째 구간인지)
+    // node마다 다시 evict 해도 되는 helper_scans 값. used_bytes는 global helper가 훑을 때만 새로 세므로
+    // evict 한 뒤 새로 시작한 scan이 끝나기 전의 값으로 또 evict 하지 않도록 한다.
+    std::vector<unsigned long long> evict_after;
 
-    LFNODE *init_bucket(uintptr_t bucket);
+    // 아래 vector들은 max_nodes 크기이고, 한번도 add 하지 않은 node의 replica는 nullptr이다.
+    std::unique_ptr<std::atomic_int[]> replica_state;
+    std::unique_ptr<NotificationCount[]> noti_counts;
+    std::atomic_uint fallback_replica{0}; // replica가 준비되지 않은 node의 thread가 쓰는 ready replica
+    std::atomic_ullong helper_scans{0};   // global helper가 list를 끝까지 훑은 횟수
+    BucketGrowth growth;
+    std::mutex replica_lock;              // add_replica/retire_replica 직렬화
 
+    bool partial_replication = false;
+    std::vector<SegmentCounters *> access_counts;           // partial replication일 때만 사용
+    std::vector<std::vector<uintptr_t>> refreshing_segments; // node마다 home에서 빠진 entry를 더 채워야 하는 segment
+    std::vector<std::chrono::steady_clock::time_point> next_rebalance;
+
+    std::atomic_bool stop_helpers{false};
+    std::unique_ptr<std::atomic_bool[]> helper_stops; // node별 local helper 종료
+    std::vector<std::atomic_int> helper_tid; // [0]은 global helper, [i + 1]은 node i의 local helper
     std::thread global_helper;
     std::vector<std::thread> local_helpers;
 
-    BucketArray* get_bucket_array();
-    atomic_uintptr_t* get_bucket_num();
+    void alloc_replica(unsigned node, LFNODE *first_bucket);
+    void start_local_helper(unsigned node, bool fill);
+    void fill_replica(unsigned node);
+    std::vector<unsigned> ready_replicas() const;
+    unsigned replica_index() const;
+    std::atomic_uintptr_t* get_bucket_num();
 };
 
 void pin_thread();
 
+// split-ordered key 변환. 모든 operation이 거치므로 header에 두어 호출한 곳에 inline 되게 한다.
+constexpr unsigned long KEY_MASK = 1ul << 63;
+
+constexpr std::array<unsigned char, 256> make_reverse_table()
+{
+    std::array<unsigned char, 256> table{};
+    for (unsigned i = 0; i < 256; ++i)
+    {
+        for (unsigned bit = 0; bit < 8; ++bit)
+        {
+            if ((i & (1u << bit)) != 0)
+                table[i] |= 1u << (7 - bit);
+        }
+    }
+    return table;
+}
+
+// byte 하나를 뒤집은 값의 lookup table
+inline constexpr std::array<unsigned char, 256> REVERSE_TABLE = make_reverse_table();
+
+inline unsigned long reverse_bits(unsigned long num)
+{
+    unsigned long result = 0;
+    for (unsigned long i = 0; i < sizeof(unsigned long); ++i)
+    {
+        result |= (unsigned long)REVERSE_TABLE[(num >> (i * 8)) & 0xff] << ((sizeof(unsigned long) - i - 1) * 8);
+    }
+    return result;
+}
+
+inline unsigned long so_regular_key(unsigned long key)
+{
+    return reverse_bits(key | KEY_MASK);
+}
+
+inline unsigned long so_dummy_key(unsigned long key)
+{
+    return reverse_bits(key);
+}
+
+// bucket의 가장 높은 1 bit를 지운 bucket
+inline uintptr_t get_parent(uintptr_t bucket)
+{
+    if (bucket == 0)
+        return 0;
+    return bucket & ~((uintptr_t)1 << (63 - __builtin_clzl(bucket)));
+}
+
+} // namespace so
+
 #endif /* ADDE381D_44C2_4BEC_A967_FE5043D7D5B2 */
@@ -0,0 +1,34 @@
+#ifndef C4D8E2F1_7A3B_4C69_B05E_9F1A6D2C8E43
+#define C4D8E2F1_7A3B_4C69_B05E_9F1A6D2C8E43
+
+// SO_STRESS로 빌드하면 CAS 직전, list traversal, init_bucket, helper thread에서 stress test가 정한 지연/yield를 넣는다.
+// 보통 빌드에서는 아무 코드도 만들지 않는다.
+#ifdef SO_STRESS
+#include <atomic>
+#include <cstddef>
+
+namespace so
+{
+class LFNODE;
+
+void stress_perturb();
+// 회수된 노드를 해제하는 대신 poison 해두고, traversal이 poison된 노드를 만나면 abort 한다.
+extern bool stress_reclaim_check;
+void stress_check_node(const LFNODE *node);
+// stress_reclaim_check에서 poison 한 노드 수. 0이면 회수가 일어나지 않아 검사가 아무것도 보지 못한 것이다.
+extern std::atomic_size_t stress_poisoned_nodes;
+// partial replication에서 replica가 버린 segment 수와 실제로 해제된 segment 수.
+extern std::atomic_size_t stress_evicted_segments;
+extern std::atomic_size_t stress_freed_segments;
+// reclaim_bulk()이 돌려준 수의 합. erase_if/clear로 떼어낸 노드가 실제로 회수되는지 stress test가 확인한다.
+extern std::atomic_size_t stress_bulk_reclaimed;
+} // namespace so
+
+#define SO_PERTURB() stress_perturb()
+#define SO_CHECK_NODE(node) stress_check_node(node)
+#else
+#define SO_PERTURB()
+#define SO_CHECK_NODE(node)
+#endif
+
+#endif /* C4D8E2F1_7A3B_4C69_B05E_9F1A6D2C8E43 */
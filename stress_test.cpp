@@ -0,0 +1,999 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "flight_recorder.h"
+#include "lf_set.h"
+#include "perf_counters.h"
+#include "split_ordered.h"
+#include "stress_hooks.h"
+#include "topology.h"
+#include "trace.h"
+
+// 여러 thread가 동시에 insert/remove/find를 실행한 history를 기록하고, key마다 linearizable 한지 검사한다.
+// CAS 직전이나 helper thread에 무작위 지연을 넣어서 드문 interleaving이 자주 일어나도록 한다.
+using namespace std;
+using namespace chrono;
+using namespace so;
+
+struct StressConfig
+{
+    unsigned threads = 4;
+    unsigned nodes = 2;
+    unsigned rounds = 3;
+    unsigned ops = 20000; // thread 하나가 phase 하나에서 실행하는 operation 수
+    unsigned long key_range = 512;
+    unsigned perturb_percent = 5;
+    unsigned max_delay_ns = 2000;
+    unsigned long seed = 1;
+    bool bytes = false; // key/value를 byte string으로 바꿔서 string_view API를 검사
+    bool cache = false; // TTL 만료와 memory budget eviction을 검사
+    bool multi = false; // phase 1의 update를 (2k, 2k+1) 쌍에 대한 multi_update로 실행
+    bool elastic = false; // replica 하나로 시작해서 operation 도중에 replica를 add/retire
+    bool slow_ops = false; // slow operation recorder의 기록과 signal dump를 검사
+    bool changes = false; // change feed를 작은 ring으로 읽으면서 table을 그대로 따라 만들 수 있는지 검사
+    bool trace = false; // 기록한 trace를 여러 thread로 replay 해도 key마다 기록된 순서대로 적용되는지 검사
+    SO_Options options;
+};
+
+static StressConfig config;
+static atomic_ulong perturb_seed{0};
+static thread_local mt19937_64 perturb_rng{config.seed * 0x9E3779B97F4A7C15 + perturb_seed.fetch_add(1)};
+
+void so::stress_perturb()
+{
+    if (config.perturb_percent == 0)
+        return;
+    auto r = perturb_rng();
+    if (r % 100 >= config.perturb_percent)
+        return;
+    if ((r >> 8) & 1)
+    {
+        this_thread::yield();
+        return;
+    }
+    auto due = steady_clock::now() + nanoseconds{(r >> 16) % (config.max_delay_ns + 1)};
+    while (steady_clock::now() < due)
+    {
+    }
+}
+
+enum class OpType : uint8_t
+{
+    INSERT,
+    REMOVE,
+    FIND,
+    UPDATE,
+};
+
+struct Event
+{
+    OpType type;
+    bool ok; // insert/remove 결과, find는 찾았는지 여부
+    unsigned long key;
+    unsigned long value; // insert 한 값 또는 find가 찾은 값
+    long long inv;
+    long long resp;
+};
+
+static long long now_ns()
+{
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Wing & Gong 방식의 탐색. 아직 linearize 안 된 op 중 가장 먼저 끝난 op보다 먼저 시작한 op만 다음 후보가 된다.
+class KeyChecker
+{
+public:
+    explicit KeyChecker(vector<Event> &&history) : ops{move(history)}, done((ops.size() + 63) / 64, 0)
+    {
+        sort(ops.begin(), ops.end(), [](auto &a, auto &b) { return a.inv < b.inv; });
+    }
+
+    bool check() { return dfs(0, nullopt); }
+
+private:
+    vector<Event> ops;
+    vector<uint64_t> done;
+    unordered_set<string> memo;
+
+    bool is_done(size_t i) const { return (done[i / 64] >> (i % 64)) & 1; }
+    void flip(size_t i) { done[i / 64] ^= (uint64_t)1 << (i % 64); }
+
+    static bool apply(const Event &op, optional<unsigned long> &state)
+    {
+        switch (op.type)
+        {
+        case OpType::INSERT:
+            if (op.ok != !state.has_value())
+                return false;
+            if (op.ok)
+                state = op.value;
+            return true;
+        case OpType::REMOVE:
+            if (op.ok != state.has_value())
+                return false;
+            state.reset();
+            return true;
+        case OpType::FIND:
+            return op.ok == state.has_value() && (!op.ok || op.value == *state);
+        case OpType::UPDATE:
+            if (op.ok != state.has_value())
+                return false;
+            if (op.ok)
+                state = op.value;
+            return true;
+        }
+        return false;
+    }
+
+    bool dfs(size_t done_num, optional<unsigned long> state)
+    {
+        if (done_num == ops.size())
+            return true;
+
+        string memo_key(reinterpret_cast<const char *>(done.data()), done.size() * sizeof(uint64_t));
+        memo_key.append(reinterpret_cast<const char *>(&state), sizeof(state));
+        if (memo.count(memo_key) != 0)
+            return false;
+
+        long long min_resp = LLONG_MAX;
+        for (size_t i = 0; i < ops.size(); ++i)
+        {
+            if (!is_done(i))
+                min_resp = min(min_resp, ops[i].resp);
+        }
+        for (size_t i = 0; i < ops.size() && ops[i].inv <= min_resp; ++i)
+        {
+            if (is_done(i))
+                continue;
+            auto next_state = state;
+            if (!apply(ops[i], next_state))
+                continue;
+            flip(i);
+            bool ok = dfs(done_num + 1, next_state);
+            flip(i);
+            if (ok)
+                return true;
+        }
+        memo.insert(move(memo_key));
+        return false;
+    }
+};
+
+// --bytes일 때 정수 key/value를 byte string으로 바꾼다. value는 inline/out-of-line이 섞이도록 길이를 바꾼다.
+static string bytes_key_of(unsigned long key)
+{
+    return "session:" + to_string(key);
+}
+
+static string bytes_value_of(unsigned long value)
+{
+    auto str = to_string(value);
+    str.push_back(':');
+    str.append(value % 300, 'v');
+    return str;
+}
+
+static bool insert_op(SO_Hashtable &table, unsigned long key, unsigned long value)
+{
+    if (config.bytes)
+        return table.insert(bytes_key_of(key), bytes_value_of(value));
+    return table.insert(key, value);
+}
+
+static bool remove_op(SO_Hashtable &table, unsigned long key)
+{
+    if (config.bytes)
+        return table.remove(bytes_key_of(key));
+    return table.remove(key);
+}
+
+static optional<unsigned long> find_op(SO_Hashtable &table, unsigned long key)
+{
+    if (false == config.bytes)
+        return table.find(key);
+    auto found = table.find(bytes_key_of(key));
+    if (!found)
+        return nullopt;
+    auto value = stoul(*found);
+    if (*found != bytes_value_of(value))
+    {
+        fprintf(stderr, "key %lu has a corrupted value\n", key);
+        exit(1);
+    }
+    return value;
+}
+
+// 쌍의 두 key를 항상 함께 바꾸므로 두 key의 상태는 같다. 따라서 multi_update의 결과는 각 key의 결과로 볼 수 있다.
+static void pair_update(SO_Hashtable &table, Event ev, vector<Event> &history)
+{
+    auto type = ev.type == OpType::INSERT ? MultiOpType::INSERT
+                : ev.type == OpType::REMOVE ? MultiOpType::REMOVE
+                                            : MultiOpType::UPDATE;
+    auto first = ev.key & ~1ul;
+    ev.ok = table.multi_update({MultiOp{type, first, ev.value}, MultiOp{type, first + 1, ev.value}});
+    ev.resp = now_ns();
+    ev.key = first;
+    history.push_back(ev);
+    ev.key = first + 1;
+    history.push_back(ev);
+}
+
+// keep(key)가 참인 key에만 operation을 실행한다. multi이면 insert/remove/update를 key 쌍 단위로 실행.
+static void worker(SO_Hashtable &table, unsigned idx, unsigned long seed, bool (*keep)(unsigned long), bool multi,
+                   vector<Event> &history)
+{
+    mt19937_64 rng{seed};
+    uniform_int_distribution<unsigned long> key_dist{0, config.key_range - 1};
+    pin_thread();
+    unsigned long value_seq = 0;
+    for (unsigned i = 0; i < config.ops; ++i)
+    {
+        auto key = key_dist(rng);
+        if (!keep(key))
+            continue;
+        Event ev{};
+        ev.key = key;
+        auto cmd = rng() % 100;
+        ev.inv = now_ns();
+        if (multi && cmd < 70)
+        {
+            ev.type = cmd < 30 ? OpType::INSERT : cmd < 55 ? OpType::REMOVE : OpType::UPDATE;
+            ev.value = ((unsigned long)idx << 40) | value_seq++;
+            pair_update(table, ev, history);
+            continue;
+        }
+        if (cmd < 35)
+        {
+            ev.type = OpType::INSERT;
+            ev.value = ((unsigned long)idx << 40) | value_seq++;
+            ev.ok = insert_op(table, key, ev.value);
+        }
+        else if (cmd < 70)
+        {
+            ev.type = OpType::REMOVE;
+            ev.ok = remove_op(table, key);
+        }
+        else
+        {
+            ev.type = OpType::FIND;
+            auto found = find_op(table, key);
+            ev.ok = found.has_value();
+            ev.value = found.value_or(0);
+        }
+        ev.resp = now_ns();
+        history.push_back(ev);
+    }
+}
+
+static bool all_keys(unsigned long) { return true; }
+static bool odd_keys(unsigned long key) { return (key & 1) != 0; }
+
+// 다른 process가 같은 region을 열어서 쓴 내용이 이 process에서 보이는지 확인한다.
+static bool check_other_process(SO_Hashtable &table, const SO_Options &options)
+{
+    constexpr unsigned long child_keys = 64;
+    const unsigned long first = config.key_range;
+    pid_t child = fork();
+    if (child == 0)
+    {
+        bool inserted = true;
+        {
+            SO_Hashtable other{config.nodes, options};
+            for (unsigned long key = first; key < first + child_keys; ++key)
+                inserted = other.insert(key, key * 3) && inserted;
+        }
+        _exit(inserted ? 0 : 1);
+    }
+    int status;
+    if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return false;
+    for (unsigned long key = first; key < first + child_keys; ++key)
+    {
+        if (table.find(key) != optional<unsigned long>{key * 3})
+            return false;
+    }
+
+    // 공유 lock을 쥔 채로 죽는 process가 있어도 남은 process가 멈추지 않아야 한다.
+    const unsigned long victim_first = first + child_keys;
+    pid_t victim = fork();
+    if (victim == 0)
+    {
+        SO_Hashtable other{config.nodes, options};
+        for (unsigned long i = 0;; ++i)
+        {
+            auto key = victim_first + i % child_keys;
+            other.insert(key, key);
+            other.remove(key);
+        }
+    }
+    if (victim < 0)
+        return false;
+    this_thread::sleep_for(20ms);
+    kill(victim, SIGKILL);
+    waitpid(victim, &status, 0);
+    for (unsigned long round = 0; round < 100; ++round)
+    {
+        for (unsigned long key = victim_first; key < victim_first + child_keys; ++key)
+        {
+            table.remove(key);
+            if (false == table.insert(key, key))
+                return false;
+        }
+    }
+    return true;
+}
+
+// stop 될 때까지 1번 이후 node의 replica를 추가하고, 다 채워지면 무작위로 하나를 retire 한다.
+static void resize_replicas(SO_Hashtable &table, unsigned long seed, atomic_bool &stop)
+{
+    mt19937_64 rng{seed};
+    if (config.nodes < 2)
+        return;
+    while (false == stop.load(memory_order_relaxed))
+    {
+        for (unsigned node = 1; node < config.nodes; ++node)
+            table.add_replica(node);
+        for (unsigned node = 1; node < config.nodes; ++node)
+        {
+            while (false == table.replica_ready(node) && false == stop.load(memory_order_relaxed))
+                this_thread::yield();
+        }
+        if (stop.load(memory_order_relaxed))
+            break;
+        this_thread::sleep_for(microseconds{rng() % 2000});
+        // partial replication의 home replica(0번)는 retire 할 수 없다.
+        auto node = rng() % config.nodes;
+        if (false == (config.options.partial_replication && node == 0))
+            table.retire_replica(node);
+    }
+}
+
+// erase_if/clear로 떼어낸 노드가 global helper의 reclaim_bulk()에서 실제로 회수되는지 확인한다.
+static bool wait_bulk_reclaimed(size_t before)
+{
+    auto deadline = steady_clock::now() + 10s;
+    while (stress_bulk_reclaimed.load(memory_order_relaxed) == before)
+    {
+        if (steady_clock::now() > deadline)
+            return false;
+        this_thread::sleep_for(1ms);
+    }
+    return true;
+}
+
+static bool run_round(unsigned round)
+{
+    bool ok = true;
+    auto options = config.options;
+    if (options.engine == Engine::SHARED_MEMORY)
+    {
+        options.shm_name = "/so_stress_" + to_string(getpid()) + "_" + to_string(round);
+        options.shm_node_bytes = 64ul << 20;
+        // bucket 수가 상한에 닿은 뒤에도 맞게 동작하는지 보도록 작게 잡는다.
+        options.shm_max_buckets = 1 << 8;
+    }
+    if (config.elastic)
+        options.max_nodes = config.nodes;
+    SO_Hashtable table{config.elastic ? 1 : config.nodes, options};
+    vector<vector<Event>> histories(config.threads);
+    atomic_bool stop_resizer{false};
+    thread resizer;
+    if (config.elastic)
+        resizer = thread{resize_replicas, ref(table), config.seed * 1000 + round, ref(stop_resizer)};
+
+    // phase 1: 모든 key에 대해 insert/remove/find. table이 커지면서 bucket도 늘어난다.
+    vector<thread> workers;
+    for (unsigned i = 0; i < config.threads; ++i)
+        workers.emplace_back(worker, ref(table), i, config.seed * 1000 + round * 100 + i, all_keys, config.multi, ref(histories[i]));
+    for (auto &th : workers)
+        th.join();
+    workers.clear();
+
+    if (config.multi)
+    {
+        for (unsigned long key = 0; key + 1 < config.key_range; key += 2)
+        {
+            if (table.find(key) != table.find(key + 1))
+            {
+                fprintf(stderr, "round %u: keys %lu and %lu were updated separately\n", round, key, key + 1);
+                ok = false;
+            }
+        }
+    }
+
+    // phase 2: 홀수 key에 대한 operation과 짝수 key를 지우는 erase_if를 동시에 실행.
+    for (unsigned i = 0; i < config.threads; ++i)
+        workers.emplace_back(worker, ref(table), i, config.seed * 1000 + round * 100 + 50 + i, odd_keys, false, ref(histories[i]));
+    // erase_if는 정수 key만 지우므로 byte string key는 하나씩 remove 한다.
+    const bool bulk_engine = options.engine == Engine::SPLIT_ORDERED;
+    auto bulk_before = stress_bulk_reclaimed.load(memory_order_relaxed);
+    size_t erased = 0;
+    if (config.bytes)
+    {
+        for (unsigned long key = 0; key < config.key_range; key += 2)
+            remove_op(table, key);
+    }
+    else
+    {
+        erased = table.erase_if([](unsigned long key, unsigned long) { return (key & 1) == 0; });
+    }
+    for (auto &th : workers)
+        th.join();
+    if (bulk_engine && erased != 0 && false == wait_bulk_reclaimed(bulk_before))
+    {
+        fprintf(stderr, "round %u: nodes removed by erase_if are never reclaimed\n", round);
+        ok = false;
+    }
+    if (config.elastic)
+    {
+        // 모든 replica가 다시 채워진 뒤에 전파를 검사한다.
+        stop_resizer.store(true);
+        resizer.join();
+        for (unsigned node = 0; node < config.nodes; ++node)
+            table.add_replica(node);
+        for (unsigned node = 0; node < config.nodes; ++node)
+        {
+            while (false == table.replica_ready(node))
+                this_thread::sleep_for(1ms);
+        }
+    }
+
+    for (unsigned long key = 0; key < config.key_range; key += 2)
+    {
+        if (find_op(table, key))
+        {
+            fprintf(stderr, "round %u: key %lu survived erase_if\n", round, key);
+            ok = false;
+        }
+    }
+
+    // 짝수 key는 phase 1의 history만 검사한다. erase_if가 언제 지웠는지는 알 수 없으므로 phase 2 검사는 위에서 대신함.
+    unordered_map<unsigned long, vector<Event>> per_key;
+    for (auto &history : histories)
+    {
+        for (auto &ev : history)
+            per_key[ev.key].push_back(ev);
+    }
+    size_t checked = 0;
+    for (auto &[key, events] : per_key)
+    {
+        checked += events.size();
+        if (!KeyChecker{move(events)}.check())
+        {
+            fprintf(stderr, "round %u: history of key %lu is not linearizable\n", round, key);
+            ok = false;
+        }
+    }
+
+    // helper thread들이 모든 dummy node를 각 node의 bucket array로 전파하는지 확인.
+    auto deadline = steady_clock::now() + 10s;
+    size_t mismatch;
+    while ((mismatch = table.check_replicas()) != 0 && steady_clock::now() < deadline)
+    {
+        this_thread::sleep_for(10ms);
+    }
+    if (mismatch != 0)
+    {
+        fprintf(stderr, "round %u: %zu bucket entries are not propagated\n", round, mismatch);
+        ok = false;
+    }
+
+    // 다른 replica는 home replica가 가진 segment 중 일부만 복제한다.
+    if (options.partial_replication)
+    {
+        for (unsigned node = 1; node < config.nodes; ++node)
+        {
+            if (table.replica_segments(node) > table.replica_segments(0))
+            {
+                fprintf(stderr, "round %u: replica %u has %zu segments but the home replica has %zu\n", round, node,
+                        table.replica_segments(node), table.replica_segments(0));
+                ok = false;
+            }
+        }
+        // replica가 버린 segment는 reclaim_bulk()에서 실제로 해제되어야 메모리가 줄어든다.
+        const auto evicted = stress_evicted_segments.load(memory_order_relaxed);
+        auto freed_deadline = steady_clock::now() + 10s;
+        while (stress_freed_segments.load(memory_order_relaxed) < evicted && steady_clock::now() < freed_deadline)
+            this_thread::sleep_for(1ms);
+        if (evicted == 0)
+        {
+            fprintf(stderr, "round %u: no replica segment was evicted\n", round);
+            ok = false;
+        }
+        else if (stress_freed_segments.load(memory_order_relaxed) < evicted)
+        {
+            fprintf(stderr, "round %u: only %zu of %zu evicted segments were freed\n", round,
+                    stress_freed_segments.load(memory_order_relaxed), evicted);
+            ok = false;
+        }
+    }
+
+    if (options.engine == Engine::SHARED_MEMORY)
+    {
+        if (false == check_other_process(table, options))
+        {
+            fprintf(stderr, "round %u: writes from another process are not visible\n", round);
+            ok = false;
+        }
+        ShmHashtable::unlink(options.shm_name);
+    }
+
+    if (bulk_engine)
+    {
+        insert_op(table, 1, 1);
+        bulk_before = stress_bulk_reclaimed.load(memory_order_relaxed);
+        table.clear();
+        if (false == wait_bulk_reclaimed(bulk_before))
+        {
+            fprintf(stderr, "round %u: nodes removed by clear are never reclaimed\n", round);
+            ok = false;
+        }
+    }
+
+    printf("round %u: %zu operations on %zu keys %s\n", round, checked, per_key.size(), ok ? "OK" : "FAILED");
+    return ok;
+}
+
+// TTL이 지난 item은 바로 보이지 않고 helper가 지우는지, budget을 넘으면 자주 읽는 key를 남기고 evict 하는지 확인.
+static bool check_cache()
+{
+    bool ok = true;
+    const unsigned long key_num = config.key_range * 4;
+    {
+        SO_Hashtable table{config.nodes, config.options};
+        for (unsigned long key = 0; key < key_num; ++key)
+        {
+            if (key % 2 == 0)
+                table.insert(key, key, 50ms);
+            else
+                table.insert(key, key);
+        }
+        this_thread::sleep_for(100ms);
+        for (unsigned long key = 0; key < key_num; key += 4)
+        {
+            if (table.find(key).has_value() != (key % 2 == 1))
+            {
+                fprintf(stderr, "cache: key %lu %s\n", key, key % 2 == 0 ? "did not expire" : "expired without TTL");
+                ok = false;
+                break;
+            }
+        }
+        // find가 보지 않은 만료 item도 local helper가 지워야 한다.
+        auto deadline = steady_clock::now() + 10s;
+        while (table.memory_used() > (key_num / 2) * sizeof(LFNODE) && steady_clock::now() < deadline)
+        {
+            this_thread::sleep_for(10ms);
+        }
+        if (table.memory_used() > (key_num / 2) * sizeof(LFNODE))
+        {
+            fprintf(stderr, "cache: expired items are not swept (%zu bytes used)\n", table.memory_used());
+            ok = false;
+        }
+        // 만료된 key에는 새로 insert 할 수 있어야 한다.
+        if (false == table.insert(0ul, 7ul) || table.find(0ul) != optional<unsigned long>{7})
+        {
+            fprintf(stderr, "cache: can't insert over an expired key\n");
+            ok = false;
+        }
+    }
+
+    auto options = config.options;
+    const unsigned long budget_items = key_num / 4;
+    const unsigned long hot_num = budget_items / 4;
+    options.memory_budget = budget_items * sizeof(LFNODE);
+    SO_Hashtable table{config.nodes, options};
+    atomic_bool stop_reader{false};
+    thread reader{[&] {
+        pin_thread();
+        while (false == stop_reader.load(memory_order_relaxed))
+        {
+            for (unsigned long key = 0; key < hot_num; ++key)
+                table.find(key);
+        }
+    }};
+    for (unsigned long key = 0; key < key_num; ++key)
+        table.insert(key, key);
+    auto deadline = steady_clock::now() + 10s;
+    while (table.memory_used() > options.memory_budget && steady_clock::now() < deadline)
+    {
+        this_thread::sleep_for(10ms);
+    }
+    stop_reader.store(true);
+    reader.join();
+    // global helper가 한번 더 list를 훑은 뒤의 값으로 확인한다.
+    this_thread::sleep_for(50ms);
+
+    // 자주 읽은 key는 나머지 key보다 훨씬 많이 남아 있어야 한다.
+    size_t hot_left = 0, cold_left = 0;
+    for (unsigned long key = 0; key < hot_num; ++key)
+        hot_left += table.find(key).has_value() ? 1 : 0;
+    for (unsigned long key = hot_num; key < key_num; ++key)
+        cold_left += table.find(key).has_value() ? 1 : 0;
+    const double hot_ratio = (double)hot_left / hot_num;
+    const double cold_ratio = (double)cold_left / (key_num - hot_num);
+    // 오래된 사용량으로 거듭 evict 하지 않았다면 budget의 절반 이상은 남아 있어야 한다.
+    const bool drained = (hot_left + cold_left) * sizeof(LFNODE) < options.memory_budget / 2;
+    if (table.memory_used() > options.memory_budget || drained || hot_ratio < 0.5 || hot_ratio < 2 * cold_ratio)
+    {
+        fprintf(stderr, "cache: %zu bytes used for a budget of %zu, %zu of %lu hot keys and %zu of %lu cold keys left\n",
+                table.memory_used(), options.memory_budget, hot_left, hot_num, cold_left, key_num - hot_num);
+        ok = false;
+    }
+    printf("cache: %s\n", ok ? "OK" : "FAILED");
+    return ok;
+}
+
+// 여러 thread가 같은 key들을 insert/remove/multi_update 하고, consumer도 중간중간 erase_if를 부르는 동안 작은 ring을 계속 읽는다.
+// ring이 차면 쓰는 thread가 기다리고 sweeper는 overflow list에 넣으므로 event가 빠짐없이 모여야 한다.
+// 같은 key의 event는 seq 순서가 실제 순서와 같아야 하므로, seq 순서로 적용한 결과가 table과 같아야 한다.
+static bool check_changes()
+{
+    bool ok = true;
+    auto options = config.options;
+    options.change_feed_capacity = 256;
+    SO_Hashtable table{config.nodes, options};
+    // 여러 thread가 같은 key를 두고 다투도록 key 수를 줄인다.
+    const unsigned long key_num = max<unsigned long>(config.key_range / 8, 8);
+    atomic_size_t mutations{0};
+    atomic_bool stop_consumer{false};
+    vector<ChangeEvent> events;
+    thread consumer{[&] {
+        size_t popped;
+        unsigned long polls = 0;
+        do
+        {
+            const bool last = stop_consumer.load(memory_order_acquire);
+            popped = 0;
+            for (unsigned node = 0; node < config.nodes; ++node)
+                popped += table.poll_changes(node, events, 64);
+            // consumer가 erase_if를 불러도 sweeper가 ring을 기다리며 멈추면 안 된다.
+            if (false == last && ++polls % 64 == 0)
+                mutations += table.erase_if([polls](unsigned long key, unsigned long) { return (key + polls) % 5 == 0; });
+            if (last && popped == 0)
+                break;
+        } while (true);
+    }};
+
+    vector<thread> workers;
+    for (unsigned i = 0; i < config.threads; ++i)
+    {
+        workers.emplace_back([&, i] {
+            pin_thread();
+            mt19937_64 rng{config.seed * 1000 + i};
+            for (unsigned n = 0; n < config.ops; ++n)
+            {
+                const unsigned long key = rng() % key_num;
+                bool done;
+                size_t changed = 1;
+                switch (rng() % 5)
+                {
+                case 0:
+                case 1:
+                    done = table.insert(key, rng() % 1000);
+                    break;
+                case 2:
+                case 3:
+                    done = table.remove(key);
+                    break;
+                default:
+                {
+                    // 옆 key와 짝지어 값을 바꾸거나 옮긴다.
+                    const unsigned long other = (key + 1) % key_num;
+                    vector<MultiOp> ops{{rng() % 2 == 0 ? MultiOpType::UPDATE : MultiOpType::REMOVE, key, rng() % 1000},
+                                        {MultiOpType::INSERT, other, rng() % 1000}};
+                    done = table.multi_update(ops);
+                    changed = ops.size();
+                    break;
+                }
+                }
+                if (done)
+                    mutations.fetch_add(changed);
+            }
+        });
+    }
+    for (auto &th : workers)
+        th.join();
+    mutations += table.erase_if([](unsigned long key, unsigned long) { return key % 3 == 0; });
+    stop_consumer.store(true, memory_order_release);
+    consumer.join();
+
+    sort(events.begin(), events.end(), [](auto &a, auto &b) { return a.seq < b.seq; });
+    if (events.size() != mutations.load())
+    {
+        fprintf(stderr, "changes: %zu events for %zu mutations\n", events.size(), mutations.load());
+        ok = false;
+    }
+    unordered_map<unsigned long, unsigned long> mirror;
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        auto &ev = events[i];
+        if (ev.seq != i + 1)
+        {
+            fprintf(stderr, "changes: event %zu has seq %llu\n", i, (unsigned long long)ev.seq);
+            ok = false;
+            break;
+        }
+        // insert는 key가 없을 때, remove/update는 있을 때만 성공하므로 seq 순서가 틀리면 여기서 드러난다.
+        const bool present = mirror.count(ev.key) != 0;
+        if (present != (ev.type != ChangeType::INSERT))
+        {
+            fprintf(stderr, "changes: event seq %llu on key %lu is out of order\n", (unsigned long long)ev.seq, ev.key);
+            ok = false;
+            break;
+        }
+        if (ev.type == ChangeType::REMOVE)
+            mirror.erase(ev.key);
+        else
+            mirror[ev.key] = ev.value;
+    }
+    for (unsigned long key = 0; ok && key < key_num; ++key)
+    {
+        auto it = mirror.find(key);
+        auto mirrored = it == mirror.end() ? optional<unsigned long>{} : optional<unsigned long>{it->second};
+        if (table.find(key) != mirrored)
+        {
+            fprintf(stderr, "changes: key %lu differs from the mirror\n", key);
+            ok = false;
+        }
+    }
+    printf("changes: %zu events %s\n", events.size(), ok ? "OK" : "FAILED");
+    return ok;
+}
+
+// 겹치는 key에 대한 operation을 기록하고, 여러 thread로 replay 한 table이 trace를 순서대로 적용한 결과와 같은지 확인.
+static bool check_trace()
+{
+    const string path = "/tmp/so_stress_trace_" + to_string(getpid());
+    {
+        SO_Hashtable table{config.nodes, config.options};
+        TraceRecorder recorder;
+        table.set_trace_recorder(&recorder);
+        vector<thread> workers;
+        for (unsigned i = 0; i < config.threads; ++i)
+        {
+            workers.emplace_back([&table, i] {
+                mt19937_64 rng{config.seed * 1000 + i};
+                for (unsigned n = 0; n < config.ops; ++n)
+                {
+                    const unsigned long key = rng() % config.key_range;
+                    if (rng() % 2 == 0)
+                        table.insert(key, rng() % 1000);
+                    else
+                        table.remove(key);
+                }
+            });
+        }
+        for (auto &th : workers)
+            th.join();
+        table.set_trace_recorder(nullptr);
+        recorder.write(path);
+    }
+
+    TraceReader trace{path};
+    unlink(path.c_str());
+    unordered_map<unsigned long, unsigned long> expected;
+    for (uint64_t i = 0; i < trace.size(); ++i)
+    {
+        auto &rec = trace.records()[i];
+        if (rec.op == TraceOp::INSERT)
+            expected.emplace(rec.key, rec.value);
+        else if (rec.op == TraceOp::REMOVE)
+            expected.erase(rec.key);
+    }
+
+    bool ok = trace.size() == (uint64_t)config.threads * config.ops;
+    SO_Hashtable table{config.nodes, config.options};
+    vector<thread> replayers;
+    const auto start_t = steady_clock::now();
+    for (unsigned i = 0; i < config.threads; ++i)
+        replayers.emplace_back([&, i] { replay_trace(table, trace, i, config.threads, false, start_t); });
+    for (auto &th : replayers)
+        th.join();
+    for (unsigned long key = 0; key < config.key_range; ++key)
+    {
+        auto it = expected.find(key);
+        auto want = it == expected.end() ? optional<unsigned long>{} : optional<unsigned long>{it->second};
+        if (table.find(key) != want)
+        {
+            fprintf(stderr, "trace: key %lu differs after replay\n", key);
+            ok = false;
+        }
+    }
+    printf("trace: %llu records replayed by %u threads %s\n", (unsigned long long)trace.size(), config.threads, ok ? "OK" : "FAILED");
+    return ok;
+}
+
+// 한번에 많이 넣은 뒤 global helper가 load factor를 맞출 때까지 키우고, 모든 replica가 같은 bucket 수를 쓰는지 확인.
+static bool check_growth()
+{
+    SO_Hashtable table{config.nodes, config.options};
+    const unsigned long key_num = config.key_range * 4;
+    for (unsigned long key = 0; key < key_num; ++key)
+        table.insert(key, key);
+    auto deadline = steady_clock::now() + 10s;
+    while ((key_num / table.bucket_count() >= LOAD_FACTOR || table.check_replicas() != 0) && steady_clock::now() < deadline)
+        this_thread::sleep_for(1ms);
+    const bool ok = key_num / table.bucket_count() < LOAD_FACTOR && table.check_replicas() == 0;
+    printf("growth: %lu keys in %lu buckets after %llu steps %s\n", key_num, (unsigned long)table.bucket_count(),
+           table.growth_version(), ok ? "OK" : "FAILED");
+    return ok;
+}
+
+// threshold를 1ns로 두어 모든 operation을 기록하고, ring에 마지막 operation들이 순서대로 남는지와 signal로 dump 되는지 확인.
+static bool check_slow_ops()
+{
+    bool ok = true;
+    const unsigned long key_num = max<unsigned long>(config.key_range, SLOW_OP_RING_SIZE);
+    auto options = config.options;
+    options.slow_op_threshold = 1ns;
+    SO_Hashtable table{config.nodes, options};
+    for (unsigned long key = 0; key < key_num; ++key)
+        table.insert(key, key);
+    clear_slow_ops();
+    for (unsigned long key = 0; key < key_num; ++key)
+        table.find(key);
+
+    auto ops = collect_slow_ops();
+    uint64_t steps = 0;
+    if (ops.size() != SLOW_OP_RING_SIZE)
+    {
+        fprintf(stderr, "slow ops: %zu operations recorded for a ring of %u\n", ops.size(), SLOW_OP_RING_SIZE);
+        ok = false;
+    }
+    for (size_t i = 0; ok && i < ops.size(); ++i)
+    {
+        auto &op = ops[i];
+        const auto key = key_num - ops.size() + i;
+        steps += op.steps;
+        if (op.op != SlowOpType::FIND || op.key != key || op.bucket > key || op.latency_ns == 0 || op.tid != current_tid() ||
+            op.node != current_node() || (i != 0 && op.epoch < ops[i - 1].epoch))
+        {
+            fprintf(stderr, "slow ops: record %zu is wrong (key %lu, bucket %lu, latency %llu)\n", i, op.key, (unsigned long)op.bucket,
+                    (unsigned long long)op.latency_ns);
+            ok = false;
+        }
+    }
+    if (ok && steps == 0)
+    {
+        fprintf(stderr, "slow ops: no traversal steps were counted\n");
+        ok = false;
+    }
+
+    // threshold를 끄면 더 기록하지 않는다.
+    table.set_slow_op_threshold(0ns);
+    table.find(0ul);
+    if (collect_slow_ops().size() != ops.size())
+    {
+        fprintf(stderr, "slow ops: recorded with the threshold off\n");
+        ok = false;
+    }
+
+    // global helper가 stderr로 dump 하는지 stderr를 임시 파일로 바꿔서 확인한다.
+    FILE *captured = tmpfile();
+    fflush(stderr);
+    const int saved_stderr = dup(STDERR_FILENO);
+    dup2(fileno(captured), STDERR_FILENO);
+    dump_slow_ops_on_signal(SIGUSR2);
+    raise(SIGUSR2);
+    auto deadline = steady_clock::now() + 10s;
+    while (lseek(fileno(captured), 0, SEEK_END) == 0 && steady_clock::now() < deadline)
+        this_thread::sleep_for(10ms);
+    // dump가 끝날 때까지 기다린다.
+    this_thread::sleep_for(50ms);
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stderr);
+    signal(SIGUSR2, SIG_DFL);
+    const auto dumped = lseek(fileno(captured), 0, SEEK_END);
+    fclose(captured);
+    if (dumped <= 0)
+    {
+        fprintf(stderr, "slow ops: nothing was dumped on SIGUSR2\n");
+        ok = false;
+    }
+    printf("slow ops: %s\n", ok ? "OK" : "FAILED");
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        auto has_value = i + 1 < argc;
+        if (0 == strcmp(argv[i], "--threads") && has_value)
+            config.threads = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "--nodes") && has_value)
+            config.nodes = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "--rounds") && has_value)
+            config.rounds = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "--ops") && has_value)
+            config.ops = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "--keys") && has_value)
+            config.key_range = atol(argv[++i]);
+        else if (0 == strcmp(argv[i], "--perturb") && has_value)
+            config.perturb_percent = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "--max-delay") && has_value)
+            config.max_delay_ns = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "--seed") && has_value)
+            config.seed = atol(argv[++i]);
+        else if (0 == strcmp(argv[i], "--engine") && has_value)
+        {
+            ++i;
+            config.options.engine = 0 == strcmp(argv[i], "nr")    ? Engine::NODE_REPLICATED
+                                    : 0 == strcmp(argv[i], "shm") ? Engine::SHARED_MEMORY
+                                                                  : Engine::SPLIT_ORDERED;
+        }
+        else if (0 == strcmp(argv[i], "--owners") && has_value)
+            config.options.delegation_owners_per_node = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "--cache"))
+            config.cache = true;
+        else if (0 == strcmp(argv[i], "--multi"))
+            config.multi = true;
+        else if (0 == strcmp(argv[i], "--bytes"))
+            config.bytes = true;
+        else if (0 == strcmp(argv[i], "--elastic"))
+            config.elastic = true;
+        else if (0 == strcmp(argv[i], "--partial"))
+            config.options.partial_replication = true;
+        else if (0 == strcmp(argv[i], "--changes"))
+            config.changes = true;
+        else if (0 == strcmp(argv[i], "--trace"))
+            config.trace = true;
+        else if (0 == strcmp(argv[i], "--slow-ops"))
+            config.slow_ops = true;
+        else if (0 == strcmp(argv[i], "--reclaim-check"))
+            stress_reclaim_check = true;
+        else
+        {
+            fprintf(stderr, "usage: %s [--threads n] [--nodes n] [--rounds n] [--ops n] [--keys n] "
+                            "[--perturb percent] [--max-delay ns] [--seed n] [--engine so|nr|shm] [--owners n] [--bytes] [--multi] [--cache] [--elastic] [--partial] [--slow-ops] [--changes] [--trace] [--reclaim-check]\n",
+                    argv[0]);
+            exit(-1);
+        }
+    }
+    if (config.threads == 0 || config.threads > MAX_THREAD || config.nodes == 0 || config.key_range < 2 ||
+        ((config.bytes || config.multi || config.cache || config.elastic || config.slow_ops || config.changes || config.trace || config.options.partial_replication) && config.options.engine != Engine::SPLIT_ORDERED) ||
+        (config.bytes && config.multi))
+    {
+        fprintf(stderr, "invalid configuration\n");
+        exit(-1);
+    }
+
+    // 실제 node가 부족하면 가상 node로 나눠서 replica 전파 경로도 검사한다.
+    if (numa_topology().node_num < config.nodes)
+        simulate_numa_nodes(config.nodes);
+
+    if (config.cache)
+        return check_cache() ? 0 : 1;
+    if (config.slow_ops)
+        return check_slow_ops() ? 0 : 1;
+    if (config.changes)
+        return check_changes() ? 0 : 1;
+    if (config.trace)
+        return check_trace() ? 0 : 1;
+
+    bool ok = true;
+    for (unsigned round = 0; round < config.rounds; ++round)
+    {
+        ok = run_round(round) && ok;
+    }
+    if (config.options.engine == Engine::SPLIT_ORDERED)
+        ok = check_growth() && ok;
+    // 회수가 한번도 일어나지 않았으면 use-after-free 검사도 아무것도 검사하지 않은 것이다.
+    if (stress_reclaim_check)
+    {
+        const auto poisoned = stress_poisoned_nodes.load(memory_order_relaxed);
+        printf("reclaim check: %zu nodes poisoned %s\n", poisoned, poisoned != 0 ? "OK" : "FAILED");
+        ok = poisoned != 0 && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+#include <numa.h>
+#include "topology.h"
+
+using namespace std;
+using namespace chrono;
+
+namespace so
+{
+
+unsigned remote_delay_ns = 0;
+
+static NumaTopology detect_topology()
+{
+    NumaTopology topo;
+    topo.real_node_num = max(1, numa_num_configured_nodes());
+    topo.node_num = topo.real_node_num;
+    topo.cpu_num = max(1, numa_num_configured_cpus() / 2);
+    topo.simulated = false;
+    topo.remote_delay_ns = 0;
+
+    if (auto env = getenv("SO_VIRTUAL_NODES"); env != nullptr && atoi(env) > 0)
+    {
+        topo.node_num = atoi(env);
+        topo.simulated = true;
+    }
+    if (auto env = getenv("SO_REMOTE_DELAY_NS"); env != nullptr && topo.simulated)
+    {
+        topo.remote_delay_ns = atoi(env);
+    }
+    topo.core_per_node = max(1u, topo.cpu_num / topo.node_num);
+    remote_delay_ns = topo.remote_delay_ns;
+    return topo;
+}
+
+static NumaTopology topology = detect_topology();
+static atomic_uint tid_counter{0};
+static thread_local int t_node = -1;
+
+const NumaTopology &numa_topology()
+{
+    return topology;
+}
+
+void simulate_numa_nodes(unsigned node_num, unsigned delay_ns)
+{
+    topology.node_num = max(1u, node_num);
+    topology.core_per_node = max(1u, topology.cpu_num / topology.node_num);
+    topology.simulated = true;
+    topology.remote_delay_ns = delay_ns;
+    remote_delay_ns = delay_ns;
+}
+
+unsigned current_node()
+{
+    if (t_node < 0)
+    {
+        auto tid = tid_counter.fetch_add(1, memory_order_relaxed);
+        t_node = (tid / topology.core_per_node) % topology.node_num;
+    }
+    return t_node;
+}
+
+void set_current_node(unsigned node)
+{
+    t_node = node;
+}
+
+unsigned real_node(unsigned node)
+{
+    return node % topology.real_node_num;
+}
+
+// 가상 node는 사용 가능한 CPU들을 node 수만큼 연속된 구간으로 나눈 것이다.
+// CPU가 node보다 적으면 여러 가상 node가 같은 CPU를 공유한다.
+static void add_virtual_node_cpus(unsigned node, bitmask *cpus)
+{
+    vector<unsigned> allowed;
+    for (unsigned c = 0; c < numa_all_cpus_ptr->size; ++c)
+    {
+        if (numa_bitmask_isbitset(numa_all_cpus_ptr, c))
+            allowed.push_back(c);
+    }
+    if (allowed.empty())
+        return;
+    const unsigned chunk = max<size_t>(1, allowed.size() / topology.node_num);
+    for (unsigned i = 0; i < chunk; ++i)
+    {
+        numa_bitmask_setbit(cpus, allowed[(node * chunk + i) % allowed.size()]);
+    }
+}
+
+bool run_on_node(unsigned node)
+{
+    if (false == topology.simulated)
+        return -1 != numa_run_on_node(node);
+
+    auto cpus = numa_allocate_cpumask();
+    add_virtual_node_cpus(node, cpus);
+    bool ok = 0 == numa_sched_setaffinity(0, cpus);
+    numa_free_cpumask(cpus);
+    return ok;
+}
+
+bool run_on_nodes(unsigned node_num)
+{
+    bool ok;
+    if (false == topology.simulated)
+    {
+        auto node_mask = numa_allocate_nodemask();
+        for (unsigned i = 0; i < node_num; ++i)
+        {
+            numa_bitmask_setbit(node_mask, real_node(i));
+        }
+        ok = 0 == numa_run_on_node_mask(node_mask);
+        numa_bitmask_free(node_mask);
+        return ok;
+    }
+
+    auto cpus = numa_allocate_cpumask();
+    for (unsigned i = 0; i < node_num; ++i)
+    {
+        add_virtual_node_cpus(i, cpus);
+    }
+    ok = 0 == numa_sched_setaffinity(0, cpus);
+    numa_free_cpumask(cpus);
+    return ok;
+}
+
+void inject_remote_delay()
+{
+    auto due = steady_clock::now() + nanoseconds{remote_delay_ns};
+    while (steady_clock::now() < due)
+    {
+    }
+}
+
+} // namespace so
@@ -0,0 +1,63 @@
+#ifndef E7A41C09_3B6D_4F2E_8D15_6C9B0A2F4E71
+#define E7A41C09_3B6D_4F2E_8D15_6C9B0A2F4E71
+
+#include <utility>
+#include <numa.h>
+
+namespace so
+{
+
+// 실제 NUMA topology 또는 single socket에서 CPU들을 나눠 만든 가상 node topology.
+// 환경 변수 SO_VIRTUAL_NODES, SO_REMOTE_DELAY_NS 또는 simulate_numa_nodes()로 가상 모드를 켠다.
+struct NumaTopology
+{
+    unsigned node_num;      // 사용하는 node 수. simulated이면 가상 node 수
+    unsigned cpu_num;       // hyper-threading을 뺀 core 수
+    unsigned core_per_node;
+    unsigned real_node_num;
+    bool simulated;
+    unsigned remote_delay_ns; // 다른 (가상) node의 메모리를 읽을 때마다 넣는 지연
+};
+
+const NumaTopology &numa_topology();
+// thread나 table을 만들기 전에 호출해야 한다.
+void simulate_numa_nodes(unsigned node_num, unsigned remote_delay_ns = 0);
+
+// 현재 thread의 node. 처음 호출될 때 thread 번호 순서대로 core_per_node개씩 node에 배정된다.
+unsigned current_node();
+// helper thread처럼 thread 번호를 소모하지 않고 node를 직접 정하는 경우
+void set_current_node(unsigned node);
+// node에 해당하는 실제 NUMA node. 메모리 할당에 사용
+unsigned real_node(unsigned node);
+bool run_on_node(unsigned node);
+bool run_on_nodes(unsigned node_num);
+
+extern unsigned remote_delay_ns;
+void inject_remote_delay();
+
+// node가 현재 thread의 node가 아니면 remote access 비용을 흉내낸다.
+inline void remote_access(unsigned node)
+{
+    if (remote_delay_ns != 0 && node != current_node())
+        inject_remote_delay();
+}
+
+// numa_id번째 (가상) node의 메모리에 T를 만든다.
+template <typename T, typename... Vals>
+T *NUMA_alloc(unsigned numa_id, Vals &&... val)
+{
+    void *raw_ptr = numa_alloc_onnode(sizeof(T), real_node(numa_id));
+    T *ptr = new (raw_ptr) T(std::forward<Vals>(val)...);
+    return ptr;
+}
+
+template <typename T>
+void NUMA_dealloc(T *ptr)
+{
+    ptr->~T();
+    numa_free(ptr, sizeof(T));
+}
+
+} // namespace so
+
+#endif /* E7A41C09_3B6D_4F2E_8D15_6C9B0A2F4E71 */
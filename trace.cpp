@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "split_ordered.h"
+#include "trace.h"
+
+using namespace std;
+using namespace chrono;
+
+namespace so
+{
+
+static thread_local TraceRecorder *t_owner = nullptr;
+static thread_local vector<TraceRecord> *t_buffer = nullptr;
+
+TraceRecorder::TraceRecorder() : start_t{steady_clock::now()}
+{
+}
+
+vector<TraceRecord> *TraceRecorder::get_buffer()
+{
+    if (t_owner != this)
+    {
+        lock_guard<mutex> guard{buffers_lock};
+        buffers.emplace_back(new vector<TraceRecord>);
+        t_buffer = buffers.back().get();
+        t_owner = this;
+    }
+    return t_buffer;
+}
+
+void TraceRecorder::record(TraceOp op, unsigned long key, unsigned long value, uint32_t ttl_ms)
+{
+    TraceRecord rec{};
+    rec.time_ns = duration_cast<nanoseconds>(steady_clock::now() - start_t).count();
+    rec.key = key;
+    rec.value = value;
+    rec.op = op;
+    rec.ttl_ms = ttl_ms;
+    get_buffer()->push_back(rec);
+}
+
+void TraceRecorder::write(const string &path)
+{
+    vector<TraceRecord> merged;
+    {
+        lock_guard<mutex> guard{buffers_lock};
+        for (auto &buffer : buffers)
+        {
+            merged.insert(merged.end(), buffer->begin(), buffer->end());
+        }
+    }
+    stable_sort(merged.begin(), merged.end(), [](auto &a, auto &b) { return a.time_ns < b.time_ns; });
+
+    TraceHeader header{};
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(TraceRecord);
+    header.record_num = merged.size();
+
+    ofstream out{path, ios::binary | ios::trunc};
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(merged.data()), merged.size() * sizeof(TraceRecord));
+    if (!out)
+    {
+        throw runtime_error("can't write a trace to " + path);
+    }
+}
+
+TraceReader::TraceReader(const string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw runtime_error("can't open a trace " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(TraceHeader))
+    {
+        close(fd);
+        throw runtime_error("too small trace " + path);
+    }
+    mapped_size = st.st_size;
+    mapped = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        throw runtime_error("can't mmap a trace " + path);
+    }
+    madvise(mapped, mapped_size, MADV_SEQUENTIAL);
+
+    auto header = reinterpret_cast<const TraceHeader *>(mapped);
+    if (memcmp(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 || header->version < 1 || header->version > TRACE_VERSION ||
+        header->record_size != sizeof(TraceRecord) ||
+        header->record_num > (mapped_size - sizeof(TraceHeader)) / sizeof(TraceRecord))
+    {
+        munmap(mapped, mapped_size);
+        throw runtime_error("invalid trace " + path);
+    }
+    first = reinterpret_cast<const TraceRecord *>(header + 1);
+    record_num = header->record_num;
+}
+
+TraceReader::~TraceReader()
+{
+    munmap(mapped, mapped_size);
+}
+
+size_t replay_trace(SO_Hashtable &table, const TraceReader &trace, unsigned thread_idx, unsigned num_thread,
+                    bool paced, steady_clock::time_point start_t)
+{
+    size_t done = 0;
+    const uint64_t record_num = trace.size();
+    const TraceRecord *end = trace.records() + record_num;
+    for (const TraceRecord *rec = trace.records(); rec != end; ++rec)
+    {
+        if (trace_replay_thread(rec->key, num_thread) != thread_idx)
+            continue;
+        if (paced)
+        {
+            auto due = start_t + nanoseconds{rec->time_ns};
+            while (steady_clock::now() < due)
+            {
+                this_thread::yield();
+            }
+        }
+        switch (rec->op)
+        {
+        case TraceOp::INSERT:
+            if (rec->ttl_ms != 0)
+                table.insert(rec->key, rec->value, milliseconds{rec->ttl_ms});
+            else
+                table.insert(rec->key, rec->value);
+            break;
+        case TraceOp::REMOVE:
+            table.remove(rec->key);
+            break;
+        case TraceOp::FIND:
+            table.find(rec->key);
+            break;
+        }
+        ++done;
+    }
+    return done;
+}
+
+} // namespace so
@@ -0,0 +1,95 @@
+#ifndef B1F0C3A2_5D7E_4A8B_9C61_2E4F7A9D3B15
+#define B1F0C3A2_5D7E_4A8B_9C61_2E4F7A9D3B15
+
+#include <cstdint>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace so
+{
+
+// Trace file layout: TraceHeader 뒤에 TraceRecord가 record_num개 이어진다.
+// 모든 field는 host byte order이고, 파일을 그대로 mmap 해서 replay 한다.
+constexpr char TRACE_MAGIC[8] = {'S', 'O', 'T', 'R', 'A', 'C', 'E', '1'};
+// version 2는 version 1의 reserved 자리에 ttl_ms를 넣었다. version 1 파일은 ttl_ms가 0인 것으로 읽힌다.
+constexpr unsigned TRACE_VERSION = 2;
+// replay 할 때 record는 key의 hash로 thread에 나눈다. 한 key의 operation은 모두 한 thread가 기록된 순서대로
+// 실행하므로, replay thread 수와 상관없이 key마다 같은 순서로 적용되고 끝난 뒤의 table 내용도 같다.
+// (record 시간순으로 나눠주면 같은 key의 remove와 그 뒤의 insert가 다른 thread에서 순서가 바뀔 수 있다.)
+inline unsigned trace_replay_thread(uint64_t key, unsigned num_thread)
+{
+    return (unsigned)(((key * 0x9E3779B97F4A7C15ull) >> 32) % num_thread);
+}
+
+enum class TraceOp : uint8_t
+{
+    INSERT,
+    REMOVE,
+    FIND,
+};
+
+struct TraceHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t record_num;
+};
+
+struct TraceRecord
+{
+    uint64_t time_ns; // trace 시작부터의 시간
+    uint64_t key;
+    uint64_t value;
+    TraceOp op;
+    uint8_t reserved[3];
+    uint32_t ttl_ms; // TTL을 주고 insert 했으면 그 TTL, 아니면 0
+};
+static_assert(sizeof(TraceRecord) == 32, "TraceRecord must stay mmap-compatible");
+
+class SO_Hashtable;
+
+// 여러 thread가 동시에 record 할 수 있도록 thread마다 따로 buffer를 두고, write 할 때 시간순으로 합친다.
+class TraceRecorder
+{
+public:
+    TraceRecorder();
+    void record(TraceOp op, unsigned long key, unsigned long value, uint32_t ttl_ms = 0);
+    void write(const std::string &path);
+
+private:
+    std::chrono::steady_clock::time_point start_t;
+    std::mutex buffers_lock;
+    std::vector<std::unique_ptr<std::vector<TraceRecord>>> buffers;
+
+    std::vector<TraceRecord> *get_buffer();
+};
+
+class TraceReader
+{
+public:
+    explicit TraceReader(const std::string &path);
+    ~TraceReader();
+    TraceReader(const TraceReader &) = delete;
+
+    uint64_t size() const { return record_num; }
+    const TraceRecord *records() const { return first; }
+
+private:
+    void *mapped;
+    size_t mapped_size;
+    const TraceRecord *first;
+    uint64_t record_num;
+};
+
+// thread_idx 번째 thread가 맡은 key의 record들을 순서대로 실행한다. paced이면 record의 time_ns에 맞춰서 실행.
+// 실행한 operation 수 반환
+size_t replay_trace(SO_Hashtable &table, const TraceReader &trace, unsigned thread_idx, unsigned num_thread,
+                    bool paced, std::chrono::steady_clock::time_point start_t);
+
+} // namespace so
+
+#endif /* B1F0C3A2_5D7E_4A8B_9C61_2E4F7A9D3B15 */